@@ -0,0 +1,340 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * uhttpmock
+ * Copyright (C) The uhttpmock contributors 2026
+ *
+ * uhttpmock is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * uhttpmock is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with uhttpmock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmarks for loading, replaying and recording traces. A synthetic trace is generated according to the command line options, and each
+ * benchmark prints its results as a single line of JSON on stdout, so they can be compared between runs. Run it with `meson test --benchmark`
+ * or directly; pass `--help` for the options.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libsoup/soup.h>
+
+#include "uhm-server.h"
+
+static gint n_messages = 1000;
+static gint n_headers = 10;
+static gint body_size = 1024;
+
+static GOptionEntry option_entries[] = {
+	{ "messages", 'm', 0, G_OPTION_ARG_INT, &n_messages, "Number of messages in the generated trace", "N" },
+	{ "headers", 'H', 0, G_OPTION_ARG_INT, &n_headers, "Number of extra headers in each request and response", "N" },
+	{ "body-size", 'b', 0, G_OPTION_ARG_INT, &body_size, "Size of each response body, in bytes", "BYTES" },
+	{ NULL }
+};
+
+/* Appends @length bytes of body to @trace, as lines of at most 64 bytes each (including the newline) prefixed by @direction. */
+static void
+append_trace_body (GString *trace, const gchar *direction, gsize length)
+{
+	while (length > 0) {
+		gsize line_length = MIN (length, 64);
+
+		g_string_append (trace, direction);
+		g_string_append_len (trace, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789+/", line_length - 1);
+		g_string_append_c (trace, '\n');
+
+		length -= line_length;
+	}
+}
+
+/* Generates a trace of n_messages GET requests, each with n_headers extra headers, and with a response body of body_size bytes. */
+static GString *
+generate_trace (void)
+{
+	GString *trace;
+	gint i, j;
+
+	trace = g_string_new (NULL);
+
+	for (i = 0; i < n_messages; i++) {
+		g_string_append_printf (trace, "> GET /resource/%d?index=%d&format=json HTTP/1.1\n", i, i);
+		g_string_append (trace, "> Soup-Host: example.com\n");
+		g_string_append (trace, "> Host: example.com\n");
+
+		for (j = 0; j < n_headers; j++) {
+			g_string_append_printf (trace, "> X-Request-Header-%d: Value of request header %d\n", j, j);
+		}
+
+		g_string_append (trace, "  \n");
+
+		g_string_append (trace, "< HTTP/1.1 200 OK\n");
+		g_string_append (trace, "< Content-Type: application/octet-stream\n");
+		g_string_append_printf (trace, "< Content-Length: %d\n", body_size);
+
+		for (j = 0; j < n_headers; j++) {
+			g_string_append_printf (trace, "< X-Response-Header-%d: Value of response header %d\n", j, j);
+		}
+
+		g_string_append (trace, "< \n");
+		append_trace_body (trace, "< ", body_size);
+		g_string_append (trace, "  \n");
+	}
+
+	return trace;
+}
+
+static GFile *
+write_trace (GString *trace)
+{
+	GFile *trace_file;
+	g_autoptr(GFileIOStream) trace_stream = NULL;
+	GError *child_error = NULL;
+
+	trace_file = g_file_new_tmp ("uhttpmock-benchmark-XXXXXX", &trace_stream, &child_error);
+	g_assert_no_error (child_error);
+
+	g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (trace_stream)), trace->str, trace->len, NULL, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	g_io_stream_close (G_IO_STREAM (trace_stream), NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	return trace_file;
+}
+
+static void
+delete_trace (GFile *trace_file)
+{
+	g_autofree gchar *trace_path = NULL;
+	g_autofree gchar *hosts_path = NULL;
+
+	trace_path = g_file_get_path (trace_file);
+	hosts_path = g_strconcat (trace_path, ".hosts", NULL);
+
+	g_unlink (hosts_path);
+	g_file_delete (trace_file, NULL, NULL);
+}
+
+/* Creates a running server in online/logging mode, as used by the tests, which will replay any trace it's given. */
+static UhmServer *
+new_replay_server (gboolean enable_preload)
+{
+	UhmServer *server;
+
+	server = uhm_server_new ();
+	uhm_server_set_enable_logging (server, TRUE);
+	uhm_server_set_enable_online (server, TRUE);
+	uhm_server_set_enable_preload (server, enable_preload);
+	uhm_server_set_default_tls_certificate (server);
+
+	uhm_server_run (server);
+	uhm_resolver_add_A (uhm_server_get_resolver (server), "example.com", uhm_server_get_address (server));
+
+	return server;
+}
+
+static void
+print_result (const gchar *benchmark, const gchar *format, ...) G_GNUC_PRINTF (2, 3);
+
+/* Prints a line of JSON for a benchmark result. @format gives the result fields, without braces. */
+static void
+print_result (const gchar *benchmark, const gchar *format, ...)
+{
+	va_list args;
+	g_autofree gchar *fields = NULL;
+
+	va_start (args, format);
+	fields = g_strdup_vprintf (format, args);
+	va_end (args);
+
+	g_print ("{\"benchmark\": \"%s\", \"messages\": %d, \"headers\": %d, \"body-size\": %d, %s}\n",
+	         benchmark, n_messages, n_headers, body_size, fields);
+}
+
+/* Measures how long it takes to load the trace, either lazily or parsing all of it. */
+static void
+benchmark_load_trace (GFile *trace_file, gboolean enable_preload)
+{
+	g_autoptr(UhmServer) server = NULL;
+	gint64 start_time, end_time;
+	GError *child_error = NULL;
+
+	server = new_replay_server (enable_preload);
+
+	start_time = g_get_monotonic_time ();
+	uhm_server_load_trace (server, trace_file, NULL, &child_error);
+	end_time = g_get_monotonic_time ();
+	g_assert_no_error (child_error);
+
+	print_result (enable_preload ? "load-trace-preload" : "load-trace", "\"seconds\": %.6f", (end_time - start_time) / (gdouble) G_USEC_PER_SEC);
+
+	uhm_server_stop (server);
+}
+
+static gboolean
+accept_cert (SoupMessage *msg, GTlsCertificate *certificate, GTlsCertificateFlags errors, gpointer user_data)
+{
+	/* Allow usage of the self-signed certificate we generate. */
+	return TRUE;
+}
+
+static gint
+compare_durations_cb (gconstpointer a, gconstpointer b)
+{
+	gint64 duration_a = *((const gint64 *) a), duration_b = *((const gint64 *) b);
+
+	return (duration_a > duration_b) - (duration_a < duration_b);
+}
+
+/* Returns the @percentile (0–100) of the sorted @durations, in seconds. */
+static gdouble
+duration_percentile (GArray *durations, guint percentile)
+{
+	guint index = ((durations->len - 1) * percentile + 50) / 100;
+
+	return g_array_index (durations, gint64, index) / (gdouble) G_USEC_PER_SEC;
+}
+
+/* Measures the latency of each request in the trace when replayed through a SoupSession. */
+static void
+benchmark_replay (GFile *trace_file, gboolean enable_preload)
+{
+	g_autoptr(UhmServer) server = NULL;
+	g_autoptr(SoupSession) session = NULL;
+	g_autoptr(GArray) durations = NULL;
+	gint64 total_duration = 0;
+	gint i;
+	GError *child_error = NULL;
+
+	server = new_replay_server (enable_preload);
+	uhm_server_load_trace (server, trace_file, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	session = soup_session_new ();
+	durations = g_array_sized_new (FALSE, FALSE, sizeof (gint64), n_messages);
+
+	for (i = 0; i < n_messages; i++) {
+		g_autoptr(SoupMessage) message = NULL;
+		g_autoptr(GBytes) body = NULL;
+		g_autofree gchar *uri = NULL;
+		gint64 start_time, duration;
+
+		uri = g_strdup_printf ("https://example.com:%u/resource/%d?index=%d&format=json", uhm_server_get_port (server), i, i);
+		message = soup_message_new (SOUP_METHOD_GET, uri);
+		g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+
+		start_time = g_get_monotonic_time ();
+		body = soup_session_send_and_read (session, message, NULL, &child_error);
+		duration = g_get_monotonic_time () - start_time;
+
+		g_assert_no_error (child_error);
+		g_assert_cmpuint (soup_message_get_status (message), ==, SOUP_STATUS_OK);
+		g_assert_cmpuint (g_bytes_get_size (body), ==, body_size);
+
+		g_array_append_val (durations, duration);
+		total_duration += duration;
+	}
+
+	g_array_sort (durations, compare_durations_cb);
+
+	print_result (enable_preload ? "replay-preload" : "replay",
+	              "\"requests-per-second\": %.1f, \"p50-seconds\": %.6f, \"p90-seconds\": %.6f, \"p99-seconds\": %.6f, \"max-seconds\": %.6f",
+	              n_messages / (total_duration / (gdouble) G_USEC_PER_SEC),
+	              duration_percentile (durations, 50), duration_percentile (durations, 90), duration_percentile (durations, 99),
+	              duration_percentile (durations, 100));
+
+	uhm_server_stop (server);
+}
+
+/* Measures how quickly a trace can be recorded by passing its lines to uhm_server_received_message_chunk(). */
+static void
+benchmark_record (GString *trace)
+{
+	g_autoptr(UhmServer) server = NULL;
+	g_autoptr(GFile) trace_file = NULL;
+	g_autoptr(GFileIOStream) trace_stream = NULL;
+	const gchar *line, *line_end, *trace_end;
+	gint64 start_time, end_time;
+	gdouble seconds;
+	GError *child_error = NULL;
+
+	server = uhm_server_new ();
+	uhm_server_set_enable_logging (server, TRUE);
+	uhm_server_set_enable_online (server, TRUE);
+
+	trace_file = g_file_new_tmp ("uhttpmock-benchmark-XXXXXX", &trace_stream, &child_error);
+	g_assert_no_error (child_error);
+
+	start_time = g_get_monotonic_time ();
+
+	uhm_server_start_trace_full (server, trace_file, &child_error);
+	g_assert_no_error (child_error);
+
+	trace_end = trace->str + trace->len;
+
+	for (line = trace->str; line < trace_end; line = line_end + 1) {
+		line_end = memchr (line, '\n', trace_end - line);
+
+		uhm_server_received_message_chunk (server, line, line_end - line, &child_error);
+		g_assert_no_error (child_error);
+	}
+
+	uhm_server_end_trace (server);
+
+	end_time = g_get_monotonic_time ();
+	seconds = (end_time - start_time) / (gdouble) G_USEC_PER_SEC;
+
+	print_result ("record", "\"seconds\": %.6f, \"megabytes-per-second\": %.3f", seconds, trace->len / seconds / (1024.0 * 1024.0));
+
+	delete_trace (trace_file);
+}
+
+int
+main (int argc, char *argv[])
+{
+	g_autoptr(GOptionContext) context = NULL;
+	g_autoptr(GString) trace = NULL;
+	g_autoptr(GFile) trace_file = NULL;
+	GError *child_error = NULL;
+
+	setlocale (LC_ALL, "");
+
+	context = g_option_context_new ("— benchmark uhttpmock trace loading, replay and recording");
+	g_option_context_add_main_entries (context, option_entries, NULL);
+
+	if (!g_option_context_parse (context, &argc, &argv, &child_error)) {
+		g_printerr ("%s\n", child_error->message);
+		g_error_free (child_error);
+
+		return EXIT_FAILURE;
+	}
+
+	if (n_messages < 1 || n_headers < 0 || body_size < 0) {
+		g_printerr ("Invalid trace size.\n");
+		return EXIT_FAILURE;
+	}
+
+	trace = generate_trace ();
+	trace_file = write_trace (trace);
+
+	benchmark_load_trace (trace_file, FALSE);
+	benchmark_load_trace (trace_file, TRUE);
+	benchmark_replay (trace_file, FALSE);
+	benchmark_replay (trace_file, TRUE);
+	benchmark_record (trace);
+
+	delete_trace (trace_file);
+
+	return EXIT_SUCCESS;
+}
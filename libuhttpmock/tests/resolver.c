@@ -90,6 +90,57 @@ test_resolver_lookup_by_name (void)
 	g_object_unref (resolver);
 }
 
+/* Add several A records for the same domain, and query for them, filtering by address family. Test that invalid addresses are rejected. */
+static void
+test_resolver_lookup_by_name_multiple (void)
+{
+	UhmResolver *resolver;
+	GError *child_error = NULL;
+	GList/*<GInetAddress>*/ *addresses = NULL;
+	gchar *address_string;
+
+	resolver = uhm_resolver_new ();
+
+	/* Add some addresses for the same domain. */
+	g_assert (uhm_resolver_add_A (resolver, "example.com", "127.0.0.1") == TRUE);
+	g_assert (uhm_resolver_add_A (resolver, "example.com", "::1") == TRUE);
+	g_assert (uhm_resolver_add_A (resolver, "example.com", "10.0.0.1") == TRUE);
+	g_assert (uhm_resolver_add_A (resolver, "invalid.com", "not an address") == FALSE);
+
+	/* Query for all of them; they should be returned in the order they were added. */
+	addresses = g_resolver_lookup_by_name (G_RESOLVER (resolver), "example.com", NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_assert_cmpuint (g_list_length (addresses), ==, 3);
+
+	address_string = g_inet_address_to_string (G_INET_ADDRESS (g_list_nth_data (addresses, 2)));
+	g_assert_cmpstr (address_string, ==, "10.0.0.1");
+	g_free (address_string);
+
+	g_resolver_free_addresses (addresses);
+
+	/* Query for the IPv6 address only. */
+	addresses = g_resolver_lookup_by_name_with_flags (G_RESOLVER (resolver), "example.com", G_RESOLVER_NAME_LOOKUP_FLAGS_IPV6_ONLY, NULL,
+	                                                  &child_error);
+	g_assert_no_error (child_error);
+	assert_single_address_result (addresses, "::1");
+	g_resolver_free_addresses (addresses);
+
+	/* Query for the IPv4 addresses only. */
+	addresses = g_resolver_lookup_by_name_with_flags (G_RESOLVER (resolver), "example.com", G_RESOLVER_NAME_LOOKUP_FLAGS_IPV4_ONLY, NULL,
+	                                                  &child_error);
+	g_assert_no_error (child_error);
+	g_assert_cmpuint (g_list_length (addresses), ==, 2);
+	g_resolver_free_addresses (addresses);
+
+	/* The invalid address shouldn't have been added. */
+	addresses = g_resolver_lookup_by_name (G_RESOLVER (resolver), "invalid.com", NULL, &child_error);
+	g_assert_error (child_error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND);
+	g_assert (addresses == NULL);
+	g_clear_error (&child_error);
+
+	g_object_unref (resolver);
+}
+
 static void
 resolver_lookup_by_name_async_success_cb (GObject *source_object, GAsyncResult *result, AsyncData *data)
 {
@@ -265,6 +316,7 @@ main (int argc, char *argv[])
 	g_test_add_func ("/resolver/construction", test_resolver_construction);
 
 	g_test_add_func ("/resolver/lookup-by-name", test_resolver_lookup_by_name);
+	g_test_add_func ("/resolver/lookup-by-name/multiple", test_resolver_lookup_by_name_multiple);
 	g_test_add_func ("/resolver/lookup-by-name/async", test_resolver_lookup_by_name_async);
 	g_test_add_func ("/resolver/lookup-service", test_resolver_lookup_service);
 	g_test_add_func ("/resolver/lookup-service/async", test_resolver_lookup_service_async);
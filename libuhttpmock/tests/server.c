@@ -18,6 +18,8 @@
  */
 
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gunixsocketaddress.h>
 #include <locale.h>
 #include <string.h>
 #include <libsoup/soup.h>
@@ -240,6 +242,252 @@ test_server_properties_enable_logging (void)
 	g_object_unref (server);
 }
 
+/* Test getting and setting UhmServer:enable-preload property. */
+static void
+test_server_properties_enable_preload (void)
+{
+	UhmServer *server;
+	gboolean enable_preload;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::enable-preload", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_enable_preload (server) == FALSE);
+	g_object_get (G_OBJECT (server), "enable-preload", &enable_preload, NULL);
+	g_assert (enable_preload == FALSE);
+
+	/* Toggle the value. */
+	uhm_server_set_enable_preload (server, TRUE);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert (uhm_server_get_enable_preload (server) == TRUE);
+	g_object_get (G_OBJECT (server), "enable-preload", &enable_preload, NULL);
+	g_assert (enable_preload == TRUE);
+
+	/* Toggle the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "enable-preload", FALSE, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert (uhm_server_get_enable_preload (server) == FALSE);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting UhmServer:enable-unordered-matching property. */
+static void
+test_server_properties_enable_unordered_matching (void)
+{
+	UhmServer *server;
+	gboolean enable_unordered_matching;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::enable-unordered-matching", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_enable_unordered_matching (server) == FALSE);
+	g_object_get (G_OBJECT (server), "enable-unordered-matching", &enable_unordered_matching, NULL);
+	g_assert (enable_unordered_matching == FALSE);
+
+	/* Toggle the value. */
+	uhm_server_set_enable_unordered_matching (server, TRUE);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert (uhm_server_get_enable_unordered_matching (server) == TRUE);
+	g_object_get (G_OBJECT (server), "enable-unordered-matching", &enable_unordered_matching, NULL);
+	g_assert (enable_unordered_matching == TRUE);
+
+	/* Toggle the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "enable-unordered-matching", FALSE, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert (uhm_server_get_enable_unordered_matching (server) == FALSE);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting UhmServer:n-workers property. */
+static void
+test_server_properties_n_workers (void)
+{
+	UhmServer *server;
+	guint n_workers;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::n-workers", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert_cmpuint (uhm_server_get_n_workers (server), ==, 1);
+	g_object_get (G_OBJECT (server), "n-workers", &n_workers, NULL);
+	g_assert_cmpuint (n_workers, ==, 1);
+
+	/* Change the value. */
+	uhm_server_set_n_workers (server, 4);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert_cmpuint (uhm_server_get_n_workers (server), ==, 4);
+	g_object_get (G_OBJECT (server), "n-workers", &n_workers, NULL);
+	g_assert_cmpuint (n_workers, ==, 4);
+
+	/* Change the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "n-workers", 1, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert_cmpuint (uhm_server_get_n_workers (server), ==, 1);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting UhmServer:enable-persistent-listener property. */
+static void
+test_server_properties_enable_persistent_listener (void)
+{
+	UhmServer *server;
+	gboolean enable_persistent_listener;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::enable-persistent-listener", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_enable_persistent_listener (server) == FALSE);
+	g_object_get (G_OBJECT (server), "enable-persistent-listener", &enable_persistent_listener, NULL);
+	g_assert (enable_persistent_listener == FALSE);
+
+	/* Toggle the value. */
+	uhm_server_set_enable_persistent_listener (server, TRUE);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert (uhm_server_get_enable_persistent_listener (server) == TRUE);
+	g_object_get (G_OBJECT (server), "enable-persistent-listener", &enable_persistent_listener, NULL);
+	g_assert (enable_persistent_listener == TRUE);
+
+	/* Toggle the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "enable-persistent-listener", FALSE, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert (uhm_server_get_enable_persistent_listener (server) == FALSE);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting UhmServer:unix-socket-path property. */
+static void
+test_server_properties_unix_socket_path (void)
+{
+	UhmServer *server;
+	gchar *unix_socket_path;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::unix-socket-path", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_unix_socket_path (server) == NULL);
+	g_object_get (G_OBJECT (server), "unix-socket-path", &unix_socket_path, NULL);
+	g_assert (unix_socket_path == NULL);
+
+	/* Set the value. */
+	uhm_server_set_unix_socket_path (server, "/tmp/uhttpmock-socket");
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert_cmpstr (uhm_server_get_unix_socket_path (server), ==, "/tmp/uhttpmock-socket");
+	g_object_get (G_OBJECT (server), "unix-socket-path", &unix_socket_path, NULL);
+	g_assert_cmpstr (unix_socket_path, ==, "/tmp/uhttpmock-socket");
+	g_free (unix_socket_path);
+
+	/* Unset the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "unix-socket-path", NULL, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert (uhm_server_get_unix_socket_path (server) == NULL);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting UhmServer:enable-reuse-port property. */
+static void
+test_server_properties_enable_reuse_port (void)
+{
+	UhmServer *server;
+	gboolean enable_reuse_port;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::enable-reuse-port", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_enable_reuse_port (server) == FALSE);
+	g_object_get (G_OBJECT (server), "enable-reuse-port", &enable_reuse_port, NULL);
+	g_assert (enable_reuse_port == FALSE);
+
+	/* Toggle the value. */
+	uhm_server_set_enable_reuse_port (server, TRUE);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert (uhm_server_get_enable_reuse_port (server) == TRUE);
+	g_object_get (G_OBJECT (server), "enable-reuse-port", &enable_reuse_port, NULL);
+	g_assert (enable_reuse_port == TRUE);
+
+	/* Toggle the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "enable-reuse-port", FALSE, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert (uhm_server_get_enable_reuse_port (server) == FALSE);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting UhmServer:enable-http2 property. */
+static void
+test_server_properties_enable_http2 (void)
+{
+	UhmServer *server;
+	gboolean enable_http2;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::enable-http2", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_enable_http2 (server) == FALSE);
+	g_object_get (G_OBJECT (server), "enable-http2", &enable_http2, NULL);
+	g_assert (enable_http2 == FALSE);
+
+	/* Toggle the value. */
+	uhm_server_set_enable_http2 (server, TRUE);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert (uhm_server_get_enable_http2 (server) == TRUE);
+	g_object_get (G_OBJECT (server), "enable-http2", &enable_http2, NULL);
+	g_assert (enable_http2 == TRUE);
+
+	/* Toggle the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "enable-http2", FALSE, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert (uhm_server_get_enable_http2 (server) == FALSE);
+
+	g_object_unref (server);
+}
+
 /* Test getting the UhmServer:address property. */
 static void
 test_server_properties_address (void)
@@ -301,7 +549,7 @@ test_server_properties_resolver (void)
 static void
 test_server_properties_tls_certificate (void)
 {
-	UhmServer *server;
+	UhmServer *server, *other_server;
 	GTlsCertificate *tls_certificate, *new_tls_certificate;
 	guint counter;
 	GError *child_error = NULL;
@@ -347,6 +595,18 @@ test_server_properties_tls_certificate (void)
 	g_assert (g_tls_certificate_is_same (tls_certificate, new_tls_certificate) == TRUE);
 	g_assert_cmpuint (counter, ==, 3);
 
+	/* The default certificate should be shared with other servers. */
+	other_server = uhm_server_new ();
+	g_assert (uhm_server_set_default_tls_certificate (other_server) == new_tls_certificate);
+	g_object_unref (other_server);
+
+	/* Set the certificate to the ECDSA default. */
+	new_tls_certificate = uhm_server_set_default_tls_certificate_full (server, UHM_DEFAULT_TLS_CERTIFICATE_ECDSA);
+	g_assert (G_IS_TLS_CERTIFICATE (new_tls_certificate));
+	g_assert (uhm_server_get_tls_certificate (server) == new_tls_certificate);
+	g_assert (g_tls_certificate_is_same (tls_certificate, new_tls_certificate) == FALSE);
+	g_assert_cmpuint (counter, ==, 4);
+
 	g_object_unref (server);
 }
 
@@ -357,7 +617,7 @@ typedef struct {
 } LoggingData;
 
 static void
-set_up_logging (LoggingData *data, gconstpointer user_data)
+set_up_logging_full (LoggingData *data, gconstpointer user_data, guint n_workers, gboolean enable_reuse_port)
 {
 	UhmResolver *resolver;
 
@@ -367,6 +627,8 @@ set_up_logging (LoggingData *data, gconstpointer user_data)
 	uhm_server_set_enable_logging (data->server, TRUE);
 	uhm_server_set_enable_online (data->server, TRUE);
 	uhm_server_set_default_tls_certificate (data->server);
+	uhm_server_set_n_workers (data->server, n_workers);
+	uhm_server_set_enable_reuse_port (data->server, enable_reuse_port);
 
 	if (user_data != NULL) {
 		g_signal_connect (G_OBJECT (data->server), "handle-message", (GCallback) user_data, NULL);
@@ -380,6 +642,24 @@ set_up_logging (LoggingData *data, gconstpointer user_data)
 	data->session = soup_session_new ();
 }
 
+static void
+set_up_logging (LoggingData *data, gconstpointer user_data)
+{
+	set_up_logging_full (data, user_data, 1, FALSE);
+}
+
+static void
+set_up_logging_workers (LoggingData *data, gconstpointer user_data)
+{
+	set_up_logging_full (data, user_data, 4, FALSE);
+}
+
+static void
+set_up_logging_workers_reuse_port (LoggingData *data, gconstpointer user_data)
+{
+	set_up_logging_full (data, user_data, 4, TRUE);
+}
+
 static gboolean
 accept_cert (SoupMessage *msg, GTlsCertificate *certificate, GTlsCertificateFlags errors, gpointer user_data)
 {
@@ -529,8 +809,9 @@ test_server_logging_trace_success_normal (LoggingData *data, gconstpointer user_
 	g_main_loop_run (data->main_loop);
 }
 
-static gboolean
-server_logging_trace_success_multiple_messages_cb (LoggingData *data)
+/* Send the three messages expected by the server_logging_trace_success_multiple-messages trace. */
+static void
+send_multiple_messages (LoggingData *data)
 {
 	guint i;
 	SoupStatus expected_status_codes[] = {
@@ -539,9 +820,6 @@ server_logging_trace_success_multiple_messages_cb (LoggingData *data)
 		SOUP_STATUS_NOT_FOUND,
 	};
 
-	/* Load the trace. */
-	assert_server_load_trace (data->server, "server_logging_trace_success_multiple-messages");
-
 	/* Dummy unit test code. Send three messages. */
 	for (i = 0; i < G_N_ELEMENTS (expected_status_codes); i++) {
 		g_autoptr(GUri) uri = NULL;
@@ -556,6 +834,15 @@ server_logging_trace_success_multiple_messages_cb (LoggingData *data)
 		g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
 		g_assert_cmpuint (send_message (data->session, message, NULL), ==, expected_status_codes[i]);
 	}
+}
+
+static gboolean
+server_logging_trace_success_multiple_messages_cb (LoggingData *data)
+{
+	/* Load the trace. */
+	assert_server_load_trace (data->server, "server_logging_trace_success_multiple-messages");
+
+	send_multiple_messages (data);
 
 	g_main_loop_quit (data->main_loop);
 
@@ -570,79 +857,1061 @@ test_server_logging_trace_success_multiple_messages (LoggingData *data, gconstpo
 	g_main_loop_run (data->main_loop);
 }
 
+/* Test a server in onling/logging mode returning several responses from a multi-message trace which was parsed in full when loaded. */
+static void
+test_server_logging_trace_success_multiple_messages_preload (LoggingData *data, gconstpointer user_data)
+{
+	uhm_server_set_enable_preload (data->server, TRUE);
+
+	g_idle_add ((GSourceFunc) server_logging_trace_success_multiple_messages_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static void
+assert_histogram_count (GVariant *statistics, const gchar *histogram_name, guint64 expected_count)
+{
+	g_autoptr(GVariant) histogram = NULL;
+	g_autoptr(GVariant) buckets = NULL;
+	const guint64 *bucket_counts;
+	gsize i, n_buckets;
+	guint64 count, buckets_total = 0;
+
+	histogram = g_variant_lookup_value (statistics, histogram_name, G_VARIANT_TYPE_VARDICT);
+	g_assert_nonnull (histogram);
+
+	g_assert_true (g_variant_lookup (histogram, "count", "t", &count));
+	g_assert_cmpuint (count, ==, expected_count);
+
+	buckets = g_variant_lookup_value (histogram, "buckets", G_VARIANT_TYPE ("at"));
+	g_assert_nonnull (buckets);
+	bucket_counts = g_variant_get_fixed_array (buckets, &n_buckets, sizeof (guint64));
+
+	for (i = 0; i < n_buckets; i++) {
+		buckets_total += bucket_counts[i];
+	}
+
+	g_assert_cmpuint (buckets_total, ==, expected_count);
+}
+
 static gboolean
-server_logging_trace_failure_method_cb (LoggingData *data)
+server_logging_trace_statistics_cb (LoggingData *data)
 {
-	g_autoptr(SoupMessage) message = NULL;
+	g_autoptr(GVariant) statistics = NULL;
 	g_autoptr(GUri) uri = NULL;
-	g_autoptr(GBytes) body = NULL;
+	g_autoptr(SoupMessage) message = NULL;
+	guint64 value, connections;
 
 	/* Load the trace. */
-	assert_server_load_trace (data->server, "server_logging_trace_failure_method");
+	assert_server_load_trace (data->server, "server_logging_trace_success_multiple-messages");
 
-	/* Dummy unit test code. */
-	uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), "/test-file", NULL, NULL);
-	message = soup_message_new_from_uri (SOUP_METHOD_PUT, uri); /* Note: we use PUT here, which doesn’t match the trace */
+	send_multiple_messages (data);
 
+	/* Send an unexpected fourth message. */
+	uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), "/test-file3", NULL, NULL);
+	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
 	g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
-
-	g_assert_cmpuint (send_message (data->session, message, &body), ==, SOUP_STATUS_BAD_REQUEST);
-	g_assert_cmpstr (g_bytes_get_data (body, NULL), !=, "The document was not found. Ha.");
-	g_assert_cmpstr (g_bytes_get_data (body, NULL), ==, "Expected GET URI ‘/test-file’, but got PUT ‘/test-file’.");
-	if (strstr (soup_message_headers_get_one (soup_message_get_response_headers (message), "X-Mock-Trace-File"), "server_logging_trace_failure_method") == NULL) {
-		/* Report the error. */
-		g_assert_cmpstr (soup_message_headers_get_one (soup_message_get_response_headers (message), "X-Mock-Trace-File"), ==, "server_logging_trace_failure_method");
-	}
-	g_assert_cmpstr (soup_message_headers_get_one (soup_message_get_response_headers (message), "X-Mock-Trace-File-Offset"), ==, "1");
+	g_assert_cmpuint (send_message (data->session, message, NULL), ==, SOUP_STATUS_BAD_REQUEST);
+
+	/* Check the statistics. The first message is fetched from the trace when it's loaded, and the others (and the non-existent fourth one)
+	 * while handling requests. */
+	statistics = uhm_server_get_statistics (data->server);
+
+	g_assert_true (g_variant_lookup (statistics, "requests-handled", "t", &value));
+	g_assert_cmpuint (value, ==, 4);
+	g_assert_true (g_variant_lookup (statistics, "mismatches", "t", &value));
+	g_assert_cmpuint (value, ==, 1);
+	g_assert_true (g_variant_lookup (statistics, "trace-bytes-read", "t", &value));
+	g_assert_cmpuint (value, >, 0);
+	g_assert_true (g_variant_lookup (statistics, "bytes-written", "t", &value));
+	g_assert_cmpuint (value, >, 0);
+	g_assert_true (g_variant_lookup (statistics, "connections", "t", &connections));
+	g_assert_cmpuint (connections, >=, 1);
+	g_assert_cmpuint (connections, <=, 4);
+	g_assert_true (g_variant_lookup (statistics, "tls-handshakes", "t", &value));
+	g_assert_cmpuint (value, ==, connections);
+	assert_histogram_count (statistics, "trace-fetch-time", 3);
+	assert_histogram_count (statistics, "compare-time", 3);
+
+	g_clear_pointer (&statistics, g_variant_unref);
+
+	/* Reset them. */
+	uhm_server_reset_statistics (data->server);
+	statistics = uhm_server_get_statistics (data->server);
+
+	g_assert_true (g_variant_lookup (statistics, "requests-handled", "t", &value));
+	g_assert_cmpuint (value, ==, 0);
+	g_assert_true (g_variant_lookup (statistics, "bytes-written", "t", &value));
+	g_assert_cmpuint (value, ==, 0);
+	g_assert_true (g_variant_lookup (statistics, "tls-handshakes", "t", &value));
+	g_assert_cmpuint (value, ==, 0);
+	assert_histogram_count (statistics, "compare-time", 0);
 
 	g_main_loop_quit (data->main_loop);
 
 	return FALSE;
 }
 
-/* Test a server in onling/logging mode returning a non-matching response from a trace, not matching by method. */
+/* Test that a server in online/logging mode keeps statistics about the requests it handles from a trace. */
 static void
-test_server_logging_trace_failure_method (LoggingData *data, gconstpointer user_data)
+test_server_logging_trace_statistics (LoggingData *data, gconstpointer user_data)
 {
-	g_idle_add ((GSourceFunc) server_logging_trace_failure_method_cb, data);
+	g_idle_add ((GSourceFunc) server_logging_trace_statistics_cb, data);
 	g_main_loop_run (data->main_loop);
 }
 
-static gboolean
-server_logging_trace_failure_uri_cb (LoggingData *data)
+/* Test that a connection whose TLS handshake fails is counted as a connection, but not as a TLS handshake. */
+static void
+test_server_logging_trace_statistics_handshake (LoggingData *data, gconstpointer user_data)
 {
-	g_autoptr(SoupMessage) message = NULL;
-	g_autoptr(GUri) uri = NULL;
-	g_autoptr(GBytes) body = NULL;
-
-	/* Load the trace. */
-	assert_server_load_trace (data->server, "server_logging_trace_failure_uri");
+	g_autoptr(GSocketClient) client = NULL;
+	g_autoptr(GSocketConnectable) connectable = NULL;
+	g_autoptr(GSocketConnection) connection = NULL;
+	g_autoptr(GVariant) statistics = NULL;
+	const gchar request[] = "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n";
+	gchar buffer[1024];
+	GError *child_error = NULL;
+	guint64 value;
 
-	/* Dummy unit test code. */
-	uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), "/test-file-wrong-uri", NULL, NULL); /* Note: wrong URI */
-	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+	/* Send a plain HTTP request to the HTTPS server. The server should close the connection once the handshake fails. */
+	client = g_socket_client_new ();
+	connectable = uhm_server_get_connectable (data->server);
+	connection = g_socket_client_connect (client, connectable, NULL, &child_error);
+	g_assert_no_error (child_error);
 
-	g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+	g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (connection)), request, strlen (request), NULL, NULL,
+	                           &child_error);
+	g_assert_no_error (child_error);
 
-	g_assert_cmpuint (send_message (data->session, message, &body), ==, SOUP_STATUS_BAD_REQUEST);
-	g_assert_cmpstr (g_bytes_get_data (body, NULL), !=, "The document was not found. Ha.");
-	g_assert_cmpstr (g_bytes_get_data (body, NULL), ==, "Expected GET URI ‘/test-file’, but got GET ‘/test-file-wrong-uri’.");
-	if (strstr (soup_message_headers_get_one (soup_message_get_response_headers (message), "X-Mock-Trace-File"), "server_logging_trace_failure_uri") == NULL) {
-		/* Report the error. */
-		g_assert_cmpstr (soup_message_headers_get_one (soup_message_get_response_headers (message), "X-Mock-Trace-File"), ==, "server_logging_trace_failure_uri");
-	}
-	g_assert_cmpstr (soup_message_headers_get_one (soup_message_get_response_headers (message), "X-Mock-Trace-File-Offset"), ==, "1");
+	while (g_input_stream_read (g_io_stream_get_input_stream (G_IO_STREAM (connection)), buffer, sizeof (buffer), NULL, NULL) > 0);
 
-	g_main_loop_quit (data->main_loop);
+	statistics = uhm_server_get_statistics (data->server);
 
-	return FALSE;
+	g_assert_true (g_variant_lookup (statistics, "connections", "t", &value));
+	g_assert_cmpuint (value, ==, 1);
+	g_assert_true (g_variant_lookup (statistics, "tls-handshakes", "t", &value));
+	g_assert_cmpuint (value, ==, 0);
 }
 
-/* Test a server in onling/logging mode returning a non-matching response from a trace, not matching by URI. */
+/* Test that a trace logged from received message chunks is completely written out when the trace is ended. */
 static void
-test_server_logging_trace_failure_uri (LoggingData *data, gconstpointer user_data)
+test_server_logging_trace_written (void)
 {
-	g_idle_add ((GSourceFunc) server_logging_trace_failure_uri_cb, data);
+	UhmServer *server;
+	g_autoptr(GFile) trace_file = NULL;
+	g_autoptr(GFile) hosts_file = NULL;
+	g_autoptr(GFileIOStream) trace_stream = NULL;
+	g_autofree gchar *trace_path = NULL;
+	g_autofree gchar *hosts_path = NULL;
+	g_autofree gchar *contents = NULL;
+	guint i;
+	GError *child_error = NULL;
+	const gchar *chunks[] = {
+		"> GET /test-file HTTP/1.1",
+		"> Soup-Host: example.com",
+		"  ",
+		"< HTTP/1.1 200 OK",
+		"< Content-Type: text/plain",
+		"< ",
+		"< The document was found.",
+		"  ",
+	};
+
+	server = uhm_server_new ();
+	uhm_server_set_enable_online (server, TRUE);
+	uhm_server_set_enable_logging (server, TRUE);
+
+	trace_file = g_file_new_tmp ("uhttpmock-logged-trace-XXXXXX", &trace_stream, &child_error);
+	g_assert_no_error (child_error);
+
+	uhm_server_start_trace_full (server, trace_file, &child_error);
+	g_assert_no_error (child_error);
+
+	for (i = 0; i < G_N_ELEMENTS (chunks); i++) {
+		uhm_server_received_message_chunk (server, chunks[i], strlen (chunks[i]), &child_error);
+		g_assert_no_error (child_error);
+	}
+
+	uhm_server_end_trace (server);
+
+	/* Check the trace and hosts files. */
+	g_file_load_contents (trace_file, NULL, &contents, NULL, NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_assert_cmpstr (contents, ==,
+	                 "> GET /test-file HTTP/1.1\n> Soup-Host: example.com\n  \n"
+	                 "< HTTP/1.1 200 OK\n< Content-Type: text/plain\n< \n< The document was found.\n  \n");
+	g_clear_pointer (&contents, g_free);
+
+	trace_path = g_file_get_path (trace_file);
+	hosts_path = g_strconcat (trace_path, ".hosts", NULL);
+	hosts_file = g_file_new_for_path (hosts_path);
+
+	g_file_load_contents (hosts_file, NULL, &contents, NULL, NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_assert_cmpstr (contents, ==, "example.com\n");
+
+	g_file_delete (trace_file, NULL, NULL);
+	g_file_delete (hosts_file, NULL, NULL);
+	g_object_unref (server);
+}
+
+/* Test that message chunks containing nul bytes are logged without being truncated. */
+static void
+test_server_logging_trace_written_nul (void)
+{
+	UhmServer *server;
+	g_autoptr(GFile) trace_file = NULL;
+	g_autoptr(GFile) hosts_file = NULL;
+	g_autoptr(GFileIOStream) trace_stream = NULL;
+	g_autofree gchar *trace_path = NULL;
+	g_autofree gchar *hosts_path = NULL;
+	g_autofree gchar *contents = NULL;
+	gsize length;
+	GError *child_error = NULL;
+	const gchar expected[] =
+		"> POST /upload HTTP/1.1\n> Soup-Host: example.com\n> \n> a\0b\0c\n  \n"
+		"< HTTP/1.1 200 OK\n< \n< \0\0\n  \n";
+
+	server = uhm_server_new ();
+	uhm_server_set_enable_online (server, TRUE);
+	uhm_server_set_enable_logging (server, TRUE);
+
+	trace_file = g_file_new_tmp ("uhttpmock-logged-trace-XXXXXX", &trace_stream, &child_error);
+	g_assert_no_error (child_error);
+
+	uhm_server_start_trace_full (server, trace_file, &child_error);
+	g_assert_no_error (child_error);
+
+	uhm_server_received_message_chunk_with_direction (server, '>', "POST /upload HTTP/1.1", -1, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk_with_direction (server, '>', "Soup-Host: example.com", -1, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk_with_direction (server, '>', "", 0, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk_with_direction (server, '>', "a\0b\0c", 5, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk_with_direction (server, ' ', "", 0, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk (server, "< HTTP/1.1 200 OK", -1, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk (server, "< ", 2, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk (server, "< \0\0", 4, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk (server, "  ", 2, &child_error);
+	g_assert_no_error (child_error);
+
+	uhm_server_end_trace (server);
+
+	/* Check the trace file byte-for-byte. */
+	g_file_load_contents (trace_file, NULL, &contents, &length, NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_assert_cmpmem (contents, length, expected, sizeof (expected) - 1);
+
+	trace_path = g_file_get_path (trace_file);
+	hosts_path = g_strconcat (trace_path, ".hosts", NULL);
+
+	hosts_file = g_file_new_for_path (hosts_path);
+
+	g_file_delete (trace_file, NULL, NULL);
+	g_file_delete (hosts_file, NULL, NULL);
+	g_object_unref (server);
+}
+
+/* Test that a server in testing mode with a persistent listener keeps running on the same port between traces. */
+static void
+test_server_testing_persistent_listener (void)
+{
+	LoggingData data;
+	g_autoptr(GFile) trace_directory = NULL;
+	UhmResolver *resolver = NULL;
+	guint port = 0;
+	guint i;
+	GError *child_error = NULL;
+	const gchar *domain_names[] = { "example.com", NULL };
+
+	data.server = uhm_server_new ();
+	data.session = soup_session_new ();
+	data.main_loop = NULL;
+
+	trace_directory = g_file_new_for_path (TEST_FILE_DIR);
+	uhm_server_set_trace_directory (data.server, trace_directory);
+	uhm_server_set_enable_online (data.server, FALSE);
+	uhm_server_set_enable_logging (data.server, FALSE);
+	uhm_server_set_default_tls_certificate (data.server);
+	uhm_server_set_expected_domain_names (data.server, domain_names);
+	uhm_server_set_enable_persistent_listener (data.server, TRUE);
+
+	for (i = 0; i < 3; i++) {
+		uhm_server_start_trace (data.server, "server_logging_trace_success_multiple-messages", &child_error);
+		g_assert_no_error (child_error);
+
+		/* The same server should be used for every trace. */
+		if (i == 0) {
+			port = uhm_server_get_port (data.server);
+			resolver = uhm_server_get_resolver (data.server);
+		} else {
+			g_assert_cmpuint (uhm_server_get_port (data.server), ==, port);
+			g_assert (uhm_server_get_resolver (data.server) == resolver);
+		}
+
+		send_multiple_messages (&data);
+
+		uhm_server_end_trace (data.server);
+		g_assert_cmpuint (uhm_server_get_port (data.server), ==, port);
+	}
+
+	uhm_server_stop (data.server);
+	g_assert_cmpuint (uhm_server_get_port (data.server), ==, 0);
+
+	g_object_unref (data.session);
+	g_object_unref (data.server);
+}
+
+/* Test that a server in testing mode can listen on a Unix socket, and be connected to with its connectable. */
+static void
+test_server_testing_unix_socket (void)
+{
+	UhmServer *server;
+	g_autoptr(SoupSession) session = NULL;
+	g_autoptr(GSocketConnectable) connectable = NULL;
+	g_autoptr(GFile) trace_directory = NULL;
+	g_autoptr(GSocket) stale_socket = NULL;
+	g_autoptr(GSocketAddress) stale_address = NULL;
+	g_autofree gchar *socket_directory = NULL;
+	g_autofree gchar *socket_path = NULL;
+	guint i;
+	GError *child_error = NULL;
+	SoupStatus expected_status_codes[] = {
+		SOUP_STATUS_OK,
+		SOUP_STATUS_OK,
+		SOUP_STATUS_NOT_FOUND,
+	};
+
+	socket_directory = g_dir_make_tmp ("uhttpmock-unix-socket-XXXXXX", &child_error);
+	g_assert_no_error (child_error);
+	socket_path = g_build_filename (socket_directory, "socket", NULL);
+
+	/* Leave a stale socket at the path, as a crashed test process would. The server should replace it. */
+	stale_socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, &child_error);
+	g_assert_no_error (child_error);
+	stale_address = g_unix_socket_address_new (socket_path);
+	g_socket_bind (stale_socket, stale_address, FALSE, &child_error);
+	g_assert_no_error (child_error);
+	g_socket_close (stale_socket, &child_error);
+	g_assert_no_error (child_error);
+	g_assert (g_file_test (socket_path, G_FILE_TEST_EXISTS) == TRUE);
+
+	server = uhm_server_new ();
+	trace_directory = g_file_new_for_path (TEST_FILE_DIR);
+	uhm_server_set_trace_directory (server, trace_directory);
+	uhm_server_set_enable_online (server, FALSE);
+	uhm_server_set_enable_logging (server, FALSE);
+	uhm_server_set_default_tls_certificate (server);
+	uhm_server_set_unix_socket_path (server, socket_path);
+
+	uhm_server_start_trace (server, "server_logging_trace_success_multiple-messages", &child_error);
+	g_assert_no_error (child_error);
+
+	g_assert (uhm_server_get_address (server) == NULL);
+	g_assert_cmpuint (uhm_server_get_port (server), ==, 0);
+	g_assert (g_file_test (socket_path, G_FILE_TEST_EXISTS) == TRUE);
+
+	connectable = uhm_server_get_connectable (server);
+	g_assert (G_IS_SOCKET_CONNECTABLE (connectable));
+	session = soup_session_new_with_options ("remote-connectable", connectable, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS (expected_status_codes); i++) {
+		g_autoptr(GUri) uri = NULL;
+		g_autofree char *uri_path = NULL;
+		g_autoptr(SoupMessage) message = NULL;
+
+		uri_path = g_strdup_printf ("/test-file%u", i);
+		uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", -1, uri_path, NULL, NULL);
+
+		message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+		g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+		g_assert_cmpuint (send_message (session, message, NULL), ==, expected_status_codes[i]);
+	}
+
+	uhm_server_end_trace (server);
+
+	/* The socket should be removed when the server stops. */
+	g_assert (g_file_test (socket_path, G_FILE_TEST_EXISTS) == FALSE);
+	g_assert (g_rmdir (socket_directory) == 0);
+
+	g_object_unref (server);
+}
+
+/* Test that a server in testing mode replays a HTTP/1.1 trace over HTTP/2 if that's negotiated, with one worker and with several. */
+static void
+test_server_testing_http2 (void)
+{
+	guint n_workers[] = { 1, 4 };
+	guint i, j;
+	const gchar *domain_names[] = { "example.com", NULL };
+	SoupStatus expected_status_codes[] = {
+		SOUP_STATUS_OK,
+		SOUP_STATUS_OK,
+		SOUP_STATUS_NOT_FOUND,
+	};
+
+	/* libsoup only speaks HTTP/2 in servers if this is set, and it can't be set safely once the test program has started threads. */
+	if (g_getenv ("SOUP_SERVER_HTTP2") == NULL) {
+		g_test_skip ("SOUP_SERVER_HTTP2 must be set in the environment to test HTTP/2");
+		return;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (n_workers); i++) {
+		UhmServer *server;
+		g_autoptr(SoupSession) session = NULL;
+		g_autoptr(GFile) trace_directory = NULL;
+		GError *child_error = NULL;
+
+		server = uhm_server_new ();
+		trace_directory = g_file_new_for_path (TEST_FILE_DIR);
+		uhm_server_set_trace_directory (server, trace_directory);
+		uhm_server_set_enable_online (server, FALSE);
+		uhm_server_set_enable_logging (server, FALSE);
+		uhm_server_set_default_tls_certificate (server);
+		uhm_server_set_expected_domain_names (server, domain_names);
+		uhm_server_set_n_workers (server, n_workers[i]);
+		uhm_server_set_enable_http2 (server, TRUE);
+
+		uhm_server_start_trace (server, "server_logging_trace_success_multiple-messages", &child_error);
+		g_assert_no_error (child_error);
+
+		session = soup_session_new ();
+
+		for (j = 0; j < G_N_ELEMENTS (expected_status_codes); j++) {
+			g_autoptr(GUri) uri = NULL;
+			g_autofree char *uri_path = NULL;
+			g_autoptr(SoupMessage) message = NULL;
+
+			uri_path = g_strdup_printf ("/test-file%u", j);
+			uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (server), uri_path, NULL, NULL);
+
+			message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+			g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+			g_assert_cmpuint (send_message (session, message, NULL), ==, expected_status_codes[j]);
+			g_assert_cmpint (soup_message_get_http_version (message), ==, SOUP_HTTP_2_0);
+		}
+
+		uhm_server_end_trace (server);
+		g_object_unref (server);
+	}
+}
+
+static gboolean
+server_logging_trace_success_workers_cb (LoggingData *data)
+{
+	guint i;
+
+	/* Load the trace. */
+	assert_server_load_trace (data->server, "server_logging_trace_success_multiple-messages");
+
+	/* Use a new connection for each message, so they're handled by different workers. */
+	for (i = 0; i < 3; i++) {
+		g_autoptr(GUri) uri = NULL;
+		g_autofree char *uri_path = NULL;
+		g_autoptr(SoupMessage) message = NULL;
+
+		uri_path = g_strdup_printf ("/test-file%u", i);
+		uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), uri_path, NULL, NULL);
+
+		message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+		soup_message_add_flags (message, SOUP_MESSAGE_NEW_CONNECTION);
+		g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+		g_assert_cmpuint (send_message (data->session, message, NULL), ==, (i < 2) ? SOUP_STATUS_OK : SOUP_STATUS_NOT_FOUND);
+	}
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in onling/logging mode returning several responses from a multi-message trace when using several worker threads. */
+static void
+test_server_logging_trace_success_workers (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_workers_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_unordered_cb (LoggingData *data)
+{
+	guint i;
+	const struct {
+		const gchar *uri_path;
+		SoupStatus expected_status_code;
+	} requests[] = {
+		{ "/test-file2", SOUP_STATUS_NOT_FOUND },
+		{ "/test-file0", SOUP_STATUS_OK },
+		{ "/test-file1", SOUP_STATUS_OK },
+		/* Each message in the trace may only be used once. */
+		{ "/test-file0", SOUP_STATUS_BAD_REQUEST },
+	};
+
+	/* Load the trace. */
+	assert_server_load_trace (data->server, "server_logging_trace_success_multiple-messages");
+
+	/* Dummy unit test code. Send the messages in a different order from the trace. */
+	for (i = 0; i < G_N_ELEMENTS (requests); i++) {
+		g_autoptr(GUri) uri = NULL;
+		g_autoptr(SoupMessage) message = NULL;
+
+		uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), requests[i].uri_path,
+		                   NULL, NULL);
+
+		message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+		g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+		g_assert_cmpuint (send_message (data->session, message, NULL), ==, requests[i].expected_status_code);
+	}
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in onling/logging mode returning responses from a multi-message trace when requests arrive out of order. */
+static void
+test_server_logging_trace_success_unordered (LoggingData *data, gconstpointer user_data)
+{
+	uhm_server_set_enable_unordered_matching (data->server, TRUE);
+
+	g_idle_add ((GSourceFunc) server_logging_trace_success_unordered_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_compiled_cb (LoggingData *data)
+{
+	g_autoptr(GFile) trace_file = NULL;
+	g_autoptr(GFile) compiled_trace_file = NULL;
+	g_autoptr(GFileIOStream) compiled_trace_stream = NULL;
+	GError *child_error = NULL;
+
+	/* Compile the trace. */
+	trace_file = g_file_new_for_path (TEST_FILE_DIR "server_logging_trace_success_multiple-messages");
+	compiled_trace_file = g_file_new_tmp ("uhttpmock-compiled-trace-XXXXXX", &compiled_trace_stream, &child_error);
+	g_assert_no_error (child_error);
+
+	uhm_server_compile_trace (trace_file, compiled_trace_file, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	/* Load the compiled trace. */
+	uhm_server_load_trace (data->server, compiled_trace_file, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	send_multiple_messages (data);
+
+	uhm_server_unload_trace (data->server);
+	g_file_delete (compiled_trace_file, NULL, NULL);
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in onling/logging mode returning several responses from a compiled multi-message trace. */
+static void
+test_server_logging_trace_success_compiled (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_compiled_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_failure_compiled_cb (LoggingData *data)
+{
+	g_autoptr(GFile) compiled_trace_file = NULL;
+	g_autoptr(GFileIOStream) compiled_trace_stream = NULL;
+	GError *child_error = NULL;
+	/* A header, no records, and a trailer claiming 4 messages in an index at offset 2^64 - 16: that offset plus the length of the index
+	 * wraps around to the offset of the trailer. */
+	const guint8 corrupt_trace[] = {
+		'U', 'H', 'M', 'T', 'R', 'A', 'C', 'E', 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0xf0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	};
+
+	compiled_trace_file = g_file_new_tmp ("uhttpmock-compiled-trace-XXXXXX", &compiled_trace_stream, &child_error);
+	g_assert_no_error (child_error);
+
+	g_file_replace_contents (compiled_trace_file, (const gchar *) corrupt_trace, sizeof (corrupt_trace), NULL, FALSE, G_FILE_CREATE_NONE,
+	                         NULL, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	/* Loading the trace should fail cleanly. */
+	uhm_server_load_trace (data->server, compiled_trace_file, NULL, &child_error);
+	g_assert_error (child_error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_clear_error (&child_error);
+
+	g_file_delete (compiled_trace_file, NULL, NULL);
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test that a compiled trace with a corrupt trailer is rejected when loading it. */
+static void
+test_server_logging_trace_failure_compiled (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_failure_compiled_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_compressed_cb (LoggingData *data)
+{
+	g_autoptr(GFile) trace_file = NULL;
+	g_autoptr(GFile) compressed_trace_file = NULL;
+	g_autoptr(GFileIOStream) compressed_trace_stream = NULL;
+	g_autoptr(GFileInputStream) input_stream = NULL;
+	g_autoptr(GFileOutputStream) output_stream = NULL;
+	g_autoptr(GZlibCompressor) compressor = NULL;
+	g_autoptr(GOutputStream) compressed_output_stream = NULL;
+	GError *child_error = NULL;
+
+	/* Gzip the trace. */
+	trace_file = g_file_new_for_path (TEST_FILE_DIR "server_logging_trace_success_multiple-messages");
+	compressed_trace_file = g_file_new_tmp ("uhttpmock-compressed-trace-XXXXXX.gz", &compressed_trace_stream, &child_error);
+	g_assert_no_error (child_error);
+
+	input_stream = g_file_read (trace_file, NULL, &child_error);
+	g_assert_no_error (child_error);
+	output_stream = g_file_replace (compressed_trace_file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+	compressed_output_stream = g_converter_output_stream_new (G_OUTPUT_STREAM (output_stream), G_CONVERTER (compressor));
+	g_output_stream_splice (compressed_output_stream, G_INPUT_STREAM (input_stream),
+	                        G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	/* Load the compressed trace. */
+	uhm_server_load_trace (data->server, compressed_trace_file, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	send_multiple_messages (data);
+
+	uhm_server_unload_trace (data->server);
+	g_file_delete (compressed_trace_file, NULL, NULL);
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in online/logging mode returning several responses from a gzipped multi-message trace. */
+static void
+test_server_logging_trace_success_compressed (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_compressed_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_preloaded_cb (LoggingData *data)
+{
+	g_autoptr(GFile) trace_file = NULL;
+	g_autoptr(GFile) trace_directory = NULL;
+	g_autoptr(GFile) preloaded_trace_file = NULL;
+	g_autofree gchar *trace_directory_path = NULL;
+	GError *child_error = NULL;
+
+	/* Copy the trace into a new trace directory and preload the whole directory. */
+	trace_directory_path = g_dir_make_tmp ("uhttpmock-preloaded-traces-XXXXXX", &child_error);
+	g_assert_no_error (child_error);
+
+	trace_file = g_file_new_for_path (TEST_FILE_DIR "server_logging_trace_success_multiple-messages");
+	trace_directory = g_file_new_for_path (trace_directory_path);
+	preloaded_trace_file = g_file_get_child (trace_directory, "multiple-messages");
+
+	g_file_copy (trace_file, preloaded_trace_file, G_FILE_COPY_NONE, NULL, NULL, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	uhm_server_set_trace_directory (data->server, trace_directory);
+	uhm_server_preload_traces (data->server, NULL, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	/* Delete the trace, so that it can only be loaded from the cache. */
+	g_file_delete (preloaded_trace_file, NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_file_delete (trace_directory, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	uhm_server_load_trace (data->server, preloaded_trace_file, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	send_multiple_messages (data);
+
+	uhm_server_unload_trace (data->server);
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in online/logging mode returning several responses from a trace which was preloaded into its trace cache. */
+static void
+test_server_logging_trace_success_preloaded (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_preloaded_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_multiple_lines_cb (LoggingData *data)
+{
+	g_autoptr(SoupMessage) message = NULL;
+	g_autoptr(GUri) uri = NULL;
+	g_autoptr(GBytes) body = NULL;
+
+	/* Load the trace. Its last line deliberately has no trailing newline. */
+	assert_server_load_trace (data->server, "server_logging_trace_success_multiple-lines");
+
+	/* Dummy unit test code. */
+	uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), "/test-file", NULL, NULL);
+	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+
+	g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+
+	g_assert_cmpuint (send_message (data->session, message, &body), ==, SOUP_STATUS_OK);
+	g_assert_cmpmem (g_bytes_get_data (body, NULL), g_bytes_get_size (body),
+	                 "The first line of the document.\nThe second line of the document.\n",
+	                 strlen ("The first line of the document.\nThe second line of the document.\n"));
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in onling/logging mode returning a response with a multi-line body from a trace. */
+static void
+test_server_logging_trace_success_multiple_lines (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_multiple_lines_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_zero_fill_cb (LoggingData *data)
+{
+	g_autoptr(SoupMessage) message = NULL;
+	g_autoptr(GUri) uri = NULL;
+	g_autoptr(GInputStream) input_stream = NULL;
+	g_autoptr(GOutputStream) output_stream = NULL;
+	g_autoptr(GBytes) body = NULL;
+	const guint8 *body_data;
+	gsize body_length, i;
+	const gchar *expected_start = "The start of the document.\n";
+	GError *child_error = NULL;
+
+	/* Load the trace. Its response body is much shorter than its Content-Length. */
+	assert_server_load_trace (data->server, "server_logging_trace_success_zero-fill");
+
+	/* Dummy unit test code. */
+	uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), "/test-file", NULL, NULL);
+	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+
+	g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+
+	/* Read the whole body, which is bigger than send_message() supports. */
+	input_stream = soup_session_send (data->session, message, NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_assert_cmpuint (soup_message_get_status (message), ==, SOUP_STATUS_OK);
+
+	output_stream = g_memory_output_stream_new_resizable ();
+	g_output_stream_splice (output_stream, input_stream, G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+	                        NULL, &child_error);
+	g_assert_no_error (child_error);
+	body = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output_stream));
+
+	/* The rest of the body should have been filled with zeros. */
+	body_data = g_bytes_get_data (body, &body_length);
+	g_assert_cmpuint (body_length, ==, 200000);
+	g_assert_cmpmem (body_data, strlen (expected_start), expected_start, strlen (expected_start));
+
+	for (i = strlen (expected_start); i < body_length; i++) {
+		g_assert_cmpuint (body_data[i], ==, 0);
+	}
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in onling/logging mode returning a response whose body was only partially logged. */
+static void
+test_server_logging_trace_success_zero_fill (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_zero_fill_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_failure_method_cb (LoggingData *data)
+{
+	g_autoptr(SoupMessage) message = NULL;
+	g_autoptr(GUri) uri = NULL;
+	g_autoptr(GBytes) body = NULL;
+
+	/* Load the trace. */
+	assert_server_load_trace (data->server, "server_logging_trace_failure_method");
+
+	/* Dummy unit test code. */
+	uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), "/test-file", NULL, NULL);
+	message = soup_message_new_from_uri (SOUP_METHOD_PUT, uri); /* Note: we use PUT here, which doesn’t match the trace */
+
+	g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+
+	g_assert_cmpuint (send_message (data->session, message, &body), ==, SOUP_STATUS_BAD_REQUEST);
+	g_assert_cmpstr (g_bytes_get_data (body, NULL), !=, "The document was not found. Ha.");
+	g_assert_cmpstr (g_bytes_get_data (body, NULL), ==, "Expected GET URI ‘/test-file’, but got PUT ‘/test-file’.");
+	if (strstr (soup_message_headers_get_one (soup_message_get_response_headers (message), "X-Mock-Trace-File"), "server_logging_trace_failure_method") == NULL) {
+		/* Report the error. */
+		g_assert_cmpstr (soup_message_headers_get_one (soup_message_get_response_headers (message), "X-Mock-Trace-File"), ==, "server_logging_trace_failure_method");
+	}
+	g_assert_cmpstr (soup_message_headers_get_one (soup_message_get_response_headers (message), "X-Mock-Trace-File-Offset"), ==, "1");
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in onling/logging mode returning a non-matching response from a trace, not matching by method. */
+static void
+test_server_logging_trace_failure_method (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_failure_method_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_failure_uri_cb (LoggingData *data)
+{
+	g_autoptr(SoupMessage) message = NULL;
+	g_autoptr(GUri) uri = NULL;
+	g_autoptr(GBytes) body = NULL;
+
+	/* Load the trace. */
+	assert_server_load_trace (data->server, "server_logging_trace_failure_uri");
+
+	/* Dummy unit test code. */
+	uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), "/test-file-wrong-uri", NULL, NULL); /* Note: wrong URI */
+	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+
+	g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+
+	g_assert_cmpuint (send_message (data->session, message, &body), ==, SOUP_STATUS_BAD_REQUEST);
+	g_assert_cmpstr (g_bytes_get_data (body, NULL), !=, "The document was not found. Ha.");
+	g_assert_cmpstr (g_bytes_get_data (body, NULL), ==, "Expected GET URI ‘/test-file’, but got GET ‘/test-file-wrong-uri’.");
+	if (strstr (soup_message_headers_get_one (soup_message_get_response_headers (message), "X-Mock-Trace-File"), "server_logging_trace_failure_uri") == NULL) {
+		/* Report the error. */
+		g_assert_cmpstr (soup_message_headers_get_one (soup_message_get_response_headers (message), "X-Mock-Trace-File"), ==, "server_logging_trace_failure_uri");
+	}
+	g_assert_cmpstr (soup_message_headers_get_one (soup_message_get_response_headers (message), "X-Mock-Trace-File-Offset"), ==, "1");
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in onling/logging mode returning a non-matching response from a trace, not matching by URI. */
+static void
+test_server_logging_trace_failure_uri (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_failure_uri_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_compare_messages_cb (UhmServer *server, UhmMessage *expected_message, UhmMessage *actual_message, gpointer user_data)
+{
+	guint *counter = user_data;
+
+	/* Accept any request. */
+	*counter = *counter + 1;
+
+	return TRUE;
+}
+
+static gboolean
+server_logging_trace_success_compare_messages_cb (LoggingData *data)
+{
+	g_autoptr(SoupMessage) message = NULL;
+	g_autoptr(GUri) uri = NULL;
+	gulong handler_id;
+	guint counter = 0;
+
+	/* Load the trace. */
+	assert_server_load_trace (data->server, "server_logging_trace_failure_uri");
+
+	/* The URI doesn't match the trace, but the signal handler should accept it anyway. */
+	handler_id = g_signal_connect (data->server, "compare-messages", (GCallback) server_logging_trace_compare_messages_cb, &counter);
+
+	uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), "/test-file-wrong-uri", NULL, NULL);
+	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+
+	g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+
+	g_assert_cmpuint (send_message (data->session, message, NULL), ==, SOUP_STATUS_NOT_FOUND);
+	g_assert_cmpuint (counter, ==, 1);
+
+	g_signal_handler_disconnect (data->server, handler_id);
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test that a compare-messages signal handler is used to match requests against the trace, rather than just the default comparison. */
+static void
+test_server_logging_trace_success_compare_messages (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_compare_messages_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_methods_cb (LoggingData *data)
+{
+	g_autoptr(GUri) uri = NULL;
+	g_autoptr(SoupMessage) options_message = NULL;
+	g_autoptr(SoupMessage) head_message = NULL;
+
+	/* Load the trace. */
+	assert_server_load_trace (data->server, "server_logging_trace_success_methods");
+
+	uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), "/test-file", NULL, NULL);
+
+	options_message = soup_message_new_from_uri (SOUP_METHOD_OPTIONS, uri);
+	g_signal_connect (options_message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+	g_assert_cmpuint (send_message (data->session, options_message, NULL), ==, SOUP_STATUS_NO_CONTENT);
+	g_assert_cmpstr (soup_message_headers_get_one (soup_message_get_response_headers (options_message), "Allow"), ==, "OPTIONS, GET, HEAD");
+
+	head_message = soup_message_new_from_uri (SOUP_METHOD_HEAD, uri);
+	g_signal_connect (head_message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+	g_assert_cmpuint (send_message (data->session, head_message, NULL), ==, SOUP_STATUS_OK);
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test that traces can contain requests using methods other than the common ones. */
+static void
+test_server_logging_trace_success_methods (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_methods_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_location_cb (LoggingData *data)
+{
+	g_autoptr(SoupMessage) message = NULL;
+	g_autoptr(GUri) uri = NULL;
+	g_autoptr(GUri) location_uri = NULL;
+	const gchar *location;
+
+	/* Load the trace. */
+	assert_server_load_trace (data->server, "server_logging_trace_success_location");
+
+	uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), "/test-file", NULL, NULL);
+	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+	soup_message_add_flags (message, SOUP_MESSAGE_NO_REDIRECT);
+	g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+
+	g_assert_cmpuint (send_message (data->session, message, NULL), ==, SOUP_STATUS_FOUND);
+
+	/* The redirect should point at the mock server. */
+	location = soup_message_headers_get_one (soup_message_get_response_headers (message), "Location");
+	g_assert_nonnull (location);
+
+	location_uri = g_uri_parse (location, SOUP_HTTP_URI_FLAGS, NULL);
+	g_assert_nonnull (location_uri);
+	g_assert_cmpstr (g_uri_get_host (location_uri), ==, "example.com");
+	g_assert_cmpint (g_uri_get_port (location_uri), ==, uhm_server_get_port (data->server));
+	g_assert_cmpstr (g_uri_get_path (location_uri), ==, "/redirected-file");
+	g_assert_cmpstr (g_uri_get_query (location_uri), ==, "a=1");
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test that Location headers in a trace are rewritten to use the mock server's port. */
+static void
+test_server_logging_trace_success_location (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_location_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_ignore_parameter_values_cb (LoggingData *data)
+{
+	const gchar *ignored_parameters[] = { "token", NULL };
+	const gchar *queries[] = {
+		"a=2&b=2&token=abc123",  /* wrong value for a */
+		"a=1&b=2",  /* missing token; its presence isn't currently checked */
+		"a=1&b=2&token=xyz789",  /* different token, and in a different order */
+	};
+	SoupStatus expected_status_codes[] = {
+		SOUP_STATUS_BAD_REQUEST,
+		SOUP_STATUS_OK,
+		SOUP_STATUS_OK,
+	};
+	g_autoptr(SoupMessage) late_message = NULL;
+	g_autoptr(GUri) late_uri = NULL;
+	gulong filter_id;
+	guint i;
+
+	filter_id = uhm_server_filter_ignore_parameter_values (data->server, ignored_parameters);
+
+	for (i = 0; i < G_N_ELEMENTS (queries); i++) {
+		g_autoptr(SoupMessage) message = NULL;
+		g_autoptr(GUri) uri = NULL;
+
+		/* Load the trace afresh each time, as each successful request consumes its only message. */
+		uhm_server_unload_trace (data->server);
+		assert_server_load_trace (data->server, "server_logging_trace_success_ignore-parameter-values");
+
+		uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), "/test-file", queries[i], NULL);
+		message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+		g_signal_connect (message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+
+		g_assert_cmpuint (send_message (data->session, message, NULL), ==, expected_status_codes[i]);
+	}
+
+	uhm_server_compare_messages_remove_filter (data->server, filter_id);
+
+	/* The filter should also apply to a trace which was loaded before it was installed. */
+	uhm_server_unload_trace (data->server);
+	assert_server_load_trace (data->server, "server_logging_trace_success_ignore-parameter-values");
+	filter_id = uhm_server_filter_ignore_parameter_values (data->server, ignored_parameters);
+
+	late_uri = g_uri_build (SOUP_HTTP_URI_FLAGS, "https", NULL, "example.com", uhm_server_get_port (data->server), "/test-file",
+	                        "token=xyz789&b=2&a=1", NULL);
+	late_message = soup_message_new_from_uri (SOUP_METHOD_GET, late_uri);
+	g_signal_connect (late_message, "accept-certificate", G_CALLBACK (accept_cert), NULL);
+
+	g_assert_cmpuint (send_message (data->session, late_message, NULL), ==, SOUP_STATUS_OK);
+
+	uhm_server_compare_messages_remove_filter (data->server, filter_id);
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test that requests are matched against a trace ignoring the values of some query parameters, if a filter is installed to do that. */
+static void
+test_server_logging_trace_success_ignore_parameter_values (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_ignore_parameter_values_cb, data);
 	g_main_loop_run (data->main_loop);
 }
 
@@ -698,6 +1967,13 @@ main (int argc, char *argv[])
 	g_test_add_func ("/server/properties/trace-directory", test_server_properties_trace_directory);
 	g_test_add_func ("/server/properties/enable-online", test_server_properties_enable_online);
 	g_test_add_func ("/server/properties/enable-logging", test_server_properties_enable_logging);
+	g_test_add_func ("/server/properties/enable-preload", test_server_properties_enable_preload);
+	g_test_add_func ("/server/properties/enable-unordered-matching", test_server_properties_enable_unordered_matching);
+	g_test_add_func ("/server/properties/n-workers", test_server_properties_n_workers);
+	g_test_add_func ("/server/properties/enable-persistent-listener", test_server_properties_enable_persistent_listener);
+	g_test_add_func ("/server/properties/unix-socket-path", test_server_properties_unix_socket_path);
+	g_test_add_func ("/server/properties/enable-reuse-port", test_server_properties_enable_reuse_port);
+	g_test_add_func ("/server/properties/enable-http2", test_server_properties_enable_http2);
 	g_test_add_func ("/server/properties/address", test_server_properties_address);
 	g_test_add_func ("/server/properties/port", test_server_properties_port);
 	g_test_add_func ("/server/properties/resolver", test_server_properties_resolver);
@@ -711,6 +1987,43 @@ main (int argc, char *argv[])
 	            set_up_logging, test_server_logging_trace_success_normal, tear_down_logging);
 	g_test_add ("/server/logging/trace/success/multiple-messages", LoggingData, NULL,
 	            set_up_logging, test_server_logging_trace_success_multiple_messages, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/multiple-messages/preload", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_multiple_messages_preload, tear_down_logging);
+	g_test_add_func ("/server/logging/trace/written", test_server_logging_trace_written);
+	g_test_add_func ("/server/logging/trace/written/nul", test_server_logging_trace_written_nul);
+	g_test_add_func ("/server/testing/persistent-listener", test_server_testing_persistent_listener);
+	g_test_add_func ("/server/testing/unix-socket", test_server_testing_unix_socket);
+	g_test_add_func ("/server/testing/http2", test_server_testing_http2);
+	g_test_add ("/server/logging/trace/statistics", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_statistics, tear_down_logging);
+	g_test_add ("/server/logging/trace/statistics/handshake", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_statistics_handshake, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/workers", LoggingData, NULL,
+	            set_up_logging_workers, test_server_logging_trace_success_workers, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/workers/reuse-port", LoggingData, NULL,
+	            set_up_logging_workers_reuse_port, test_server_logging_trace_success_workers, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/unordered", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_unordered, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/compiled", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_compiled, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/compressed", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_compressed, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/preloaded", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_preloaded, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/multiple-lines", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_multiple_lines, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/zero-fill", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_zero_fill, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/compare-messages", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_compare_messages, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/methods", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_methods, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/location", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_location, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/ignore-parameter-values", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_ignore_parameter_values, tear_down_logging);
+	g_test_add ("/server/logging/trace/failure/compiled", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_failure_compiled, tear_down_logging);
 	g_test_add ("/server/logging/trace/failure/method", LoggingData, NULL,
 	            set_up_logging, test_server_logging_trace_failure_method, tear_down_logging);
 	g_test_add ("/server/logging/trace/failure/uri", LoggingData, NULL,
@@ -23,3 +23,5 @@
 
 UhmMessage *uhm_message_new_from_uri (const gchar *method, GUri *uri);
 UhmMessage *uhm_message_new_from_server_message (SoupServerMessage *smsg);
+SoupServerMessage *uhm_message_get_server_message (UhmMessage *message);
+guint64 uhm_message_get_fingerprint (UhmMessage *message);
@@ -31,6 +31,8 @@ struct _UhmMessage {
 	SoupMessageHeaders *request_headers;
 	SoupMessageBody *response_body;
 	SoupMessageHeaders *response_headers;
+	SoupServerMessage *server_message;  /* unowned; only set if created from a server message, which outlives this */
+	guint64 fingerprint;  /* hash of the parts of the request compared by the default UhmServer::compare-messages handler */
 };
 
 struct _UhmMessageClass {
@@ -79,6 +81,42 @@ uhm_message_finalize (GObject *obj)
 	G_OBJECT_CLASS (uhm_message_parent_class)->finalize (obj);
 }
 
+#define FNV_OFFSET_BASIS G_GUINT64_CONSTANT (0xcbf29ce484222325)
+#define FNV_PRIME G_GUINT64_CONSTANT (0x100000001b3)
+
+/* Adds @part to the FNV-1a hash @hash, distinguishing %NULL from the empty string and delimiting it from the next part. */
+static guint64
+fingerprint_append (guint64 hash, const gchar *part)
+{
+	const guchar *p;
+
+	hash = (hash ^ ((part != NULL) ? 1 : 0)) * FNV_PRIME;
+
+	for (p = (const guchar *) part; p != NULL && *p != '\0'; p++) {
+		hash = (hash ^ *p) * FNV_PRIME;
+	}
+
+	return hash * FNV_PRIME;  /* append a nul byte */
+}
+
+static void
+update_fingerprint (UhmMessage *msg)
+{
+	guint64 hash = FNV_OFFSET_BASIS;
+
+	hash = fingerprint_append (hash, msg->method);
+
+	if (msg->uri != NULL) {
+		hash = fingerprint_append (hash, g_uri_get_user (msg->uri));
+		hash = fingerprint_append (hash, g_uri_get_password (msg->uri));
+		hash = fingerprint_append (hash, g_uri_get_path (msg->uri));
+		hash = fingerprint_append (hash, g_uri_get_query (msg->uri));
+		hash = fingerprint_append (hash, g_uri_get_fragment (msg->uri));
+	}
+
+	msg->fingerprint = hash;
+}
+
 static void
 uhm_message_get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec)
 {
@@ -106,10 +144,12 @@ uhm_message_set_property (GObject *object, guint property_id, const GValue *valu
 	case PROP_URI:
 		g_clear_pointer (&msg->uri, g_uri_unref);
 		msg->uri = g_value_dup_boxed (value);
+		update_fingerprint (msg);
 		break;
 	case PROP_METHOD:
 		g_clear_pointer (&msg->method, g_free);
 		msg->method = g_value_dup_string (value);
+		update_fingerprint (msg);
 		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -170,9 +210,25 @@ uhm_message_new_from_server_message (SoupServerMessage *smsg)
 	msg->response_body = soup_message_body_ref (soup_server_message_get_response_body (smsg));
 	msg->response_headers = soup_message_headers_ref (soup_server_message_get_response_headers (smsg));
 
+	msg->server_message = smsg;
+
 	return msg;
 }
 
+SoupServerMessage *
+uhm_message_get_server_message (UhmMessage *message)
+{
+	return message->server_message;
+}
+
+/* Returns a hash of the method, user, password, path, query and fragment of the request, which are the parts compared by the default
+ * UhmServer::compare-messages handler. This is computed when the message is constructed, so is cheap to call. */
+guint64
+uhm_message_get_fingerprint (UhmMessage *message)
+{
+	return message->fingerprint;
+}
+
 void uhm_message_set_status (UhmMessage *message, guint status, const char *reason_phrase)
 {
 	message->status_code = status;
@@ -63,19 +63,10 @@ static GList *uhm_resolver_lookup_service (GResolver *resolver, const gchar *rrn
 static void uhm_resolver_lookup_service_async (GResolver *resolver, const gchar *rrname, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
 static GList *uhm_resolver_lookup_service_finish (GResolver *resolver, GAsyncResult *result, GError **error);
 
-typedef struct {
-	gchar *key;
-	gchar *addr;
-} FakeHost;
-
-typedef struct {
-	char *key;
-	GSrvTarget *srv;
-} FakeService;
-
 struct _UhmResolverPrivate {
-	GList *fake_A;
-	GList *fake_SRV;
+	/* Fake records, in the order they were added for each name. Addresses are parsed when they're added, so lookups don't have to. */
+	GHashTable/*<owned utf8, owned GPtrArray<owned GInetAddress>>*/ *fake_A;  /* owned */
+	GHashTable/*<owned utf8, owned GPtrArray<owned GSrvTarget>>*/ *fake_SRV;  /* owned */
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (UhmResolver, uhm_resolver, G_TYPE_RESOLVER)
@@ -103,12 +94,17 @@ static void
 uhm_resolver_init (UhmResolver *self)
 {
 	self->priv = uhm_resolver_get_instance_private (self);
+	self->priv->fake_A = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+	self->priv->fake_SRV = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
 }
 
 static void
 uhm_resolver_finalize (GObject *object)
 {
-	uhm_resolver_reset (UHM_RESOLVER (object));
+	UhmResolverPrivate *priv = UHM_RESOLVER (object)->priv;
+
+	g_hash_table_unref (priv->fake_A);
+	g_hash_table_unref (priv->fake_SRV);
 
 	/* Chain up to the parent class */
 	G_OBJECT_CLASS (uhm_resolver_parent_class)->finalize (object);
@@ -129,14 +125,19 @@ _service_rrname (const char *service, const char *protocol, const char *domain)
 static GList *
 find_fake_services (UhmResolver *self, const char *name)
 {
-	GList *fake = NULL;
+	GPtrArray/*<unowned GSrvTarget>*/ *services;
 	GList *rval = NULL;
+	guint i;
 
-	for (fake = self->priv->fake_SRV; fake != NULL; fake = g_list_next (fake)) {
-		FakeService *entry = fake->data;
-		if (entry != NULL && !g_strcmp0 (entry->key, name)) {
-			rval = g_list_append (rval, g_srv_target_copy (entry->srv));
-		}
+	services = g_hash_table_lookup (self->priv->fake_SRV, name);
+
+	if (services == NULL) {
+		return NULL;
+	}
+
+	/* Build the list backwards so it can be prepended to. */
+	for (i = services->len; i > 0; i--) {
+		rval = g_list_prepend (rval, g_srv_target_copy (g_ptr_array_index (services, i - 1)));
 	}
 
 	return rval;
@@ -145,37 +146,42 @@ find_fake_services (UhmResolver *self, const char *name)
 static void
 fake_services_free (GList/*<owned GSrvTarget>*/ *services)
 {
-	g_list_free_full (services, (GDestroyNotify) g_object_unref);
+	g_list_free_full (services, (GDestroyNotify) g_srv_target_free);
 }
 
 static GList *
 find_fake_hosts (UhmResolver *self, const char *name, GResolverNameLookupFlags flags)
 {
-	GList *fake = NULL;
+	GPtrArray/*<unowned GInetAddress>*/ *addrs;
 	GList *rval = NULL;
+	guint i;
+
+	addrs = g_hash_table_lookup (self->priv->fake_A, name);
+
+	if (addrs == NULL) {
+		return NULL;
+	}
 
-	for (fake = self->priv->fake_A; fake != NULL; fake = g_list_next (fake)) {
-		FakeHost *entry = fake->data;
-		if (entry != NULL && !g_strcmp0 (entry->key, name)) {
-			g_autoptr (GInetAddress) addr;
-			GSocketFamily fam;
-			addr = g_inet_address_new_from_string (entry->addr);
-			fam = g_inet_address_get_family (addr);
-			switch (flags) {
-				case G_RESOLVER_NAME_LOOKUP_FLAGS_IPV4_ONLY:
-					if (fam == G_SOCKET_FAMILY_IPV6)
-						continue;
-					break;
-				case G_RESOLVER_NAME_LOOKUP_FLAGS_IPV6_ONLY:
-					if (fam == G_SOCKET_FAMILY_IPV4)
-						continue;
-					break;
-				case G_RESOLVER_NAME_LOOKUP_FLAGS_DEFAULT:
-				default:
-					break;
-			}
-			rval = g_list_append (rval, g_steal_pointer (&addr));
+	/* Build the list backwards so it can be prepended to. */
+	for (i = addrs->len; i > 0; i--) {
+		GInetAddress *addr = g_ptr_array_index (addrs, i - 1);
+		GSocketFamily fam = g_inet_address_get_family (addr);
+
+		switch (flags) {
+			case G_RESOLVER_NAME_LOOKUP_FLAGS_IPV4_ONLY:
+				if (fam == G_SOCKET_FAMILY_IPV6)
+					continue;
+				break;
+			case G_RESOLVER_NAME_LOOKUP_FLAGS_IPV6_ONLY:
+				if (fam == G_SOCKET_FAMILY_IPV4)
+					continue;
+				break;
+			case G_RESOLVER_NAME_LOOKUP_FLAGS_DEFAULT:
+			default:
+				break;
 		}
+
+		rval = g_list_prepend (rval, g_object_ref (addr));
 	}
 
 	return rval;
@@ -322,27 +328,26 @@ uhm_resolver_new (void)
 void
 uhm_resolver_reset (UhmResolver *self)
 {
-	GList *fake = NULL;
-
 	g_return_if_fail (UHM_IS_RESOLVER (self));
 
-	for (fake = self->priv->fake_A; fake != NULL; fake = g_list_next (fake)) {
-		FakeHost *entry = fake->data;
-		g_free (entry->key);
-		g_free (entry->addr);
-		g_free (entry);
-	}
-	g_list_free (self->priv->fake_A);
-	self->priv->fake_A = NULL;
-
-	for (fake = self->priv->fake_SRV; fake != NULL; fake = g_list_next (fake)) {
-		FakeService *entry = fake->data;
-		g_free (entry->key);
-		g_srv_target_free (entry->srv);
-		g_free (entry);
+	g_hash_table_remove_all (self->priv->fake_A);
+	g_hash_table_remove_all (self->priv->fake_SRV);
+}
+
+/* Adds @record to the array of records for @key in @records, creating it if needed. */
+static void
+add_fake_record (GHashTable *records, const gchar *key, gpointer record, GDestroyNotify record_free_func)
+{
+	GPtrArray *array;
+
+	array = g_hash_table_lookup (records, key);
+
+	if (array == NULL) {
+		array = g_ptr_array_new_with_free_func (record_free_func);
+		g_hash_table_insert (records, g_strdup (key), array);
 	}
-	g_list_free (self->priv->fake_SRV);
-	self->priv->fake_SRV = NULL;
+
+	g_ptr_array_add (array, record);
 }
 
 /**
@@ -353,23 +358,26 @@ uhm_resolver_reset (UhmResolver *self)
  *
  * Adds a resolution mapping from the host name @hostname to the IP address @addr.
  *
- * Return value: %TRUE on success; %FALSE otherwise
+ * Return value: %TRUE on success; %FALSE otherwise (for example, if @addr is not a valid IP address)
  *
  * Since: 0.1.0
  */
 gboolean
 uhm_resolver_add_A (UhmResolver *self, const gchar *hostname, const gchar *addr)
 {
-	FakeHost *entry;
+	GInetAddress *inet_addr;
 
 	g_return_val_if_fail (UHM_IS_RESOLVER (self), FALSE);
 	g_return_val_if_fail (hostname != NULL && *hostname != '\0', FALSE);
 	g_return_val_if_fail (addr != NULL && *addr != '\0', FALSE);
 
-	entry = g_new0 (FakeHost, 1);
-	entry->key = g_strdup (hostname);
-	entry->addr = g_strdup (addr);
-	self->priv->fake_A = g_list_append (self->priv->fake_A, entry);
+	inet_addr = g_inet_address_new_from_string (addr);
+
+	if (inet_addr == NULL) {
+		return FALSE;
+	}
+
+	add_fake_record (self->priv->fake_A, hostname, inet_addr, g_object_unref);
 
 	return TRUE;
 }
@@ -393,8 +401,6 @@ gboolean
 uhm_resolver_add_SRV (UhmResolver *self, const gchar *service, const gchar *protocol, const gchar *domain, const gchar *addr, guint16 port)
 {
 	gchar *key;
-	GSrvTarget *serv;
-	FakeService *entry;
 
 	g_return_val_if_fail (UHM_IS_RESOLVER (self), FALSE);
 	g_return_val_if_fail (service != NULL && *service != '\0', FALSE);
@@ -404,11 +410,8 @@ uhm_resolver_add_SRV (UhmResolver *self, const gchar *service, const gchar *prot
 	g_return_val_if_fail (port > 0, FALSE);
 
 	key = _service_rrname (service, protocol, domain);
-	entry = g_new0 (FakeService, 1);
-	serv = g_srv_target_new (addr, port, 0, 0);
-	entry->key = key;
-	entry->srv = serv;
-	self->priv->fake_SRV = g_list_append (self->priv->fake_SRV, entry);
+	add_fake_record (self->priv->fake_SRV, key, g_srv_target_new (addr, port, 0, 0), (GDestroyNotify) g_srv_target_free);
+	g_free (key);
 
 	return TRUE;
 }
@@ -54,6 +54,8 @@
 
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <gio/gunixsocketaddress.h>
 #include <libsoup/soup.h>
 #include <string.h>
 #include <arpa/inet.h>
@@ -86,8 +88,34 @@ static void load_file_iteration_thread_cb (GTask *task, gpointer source_object,
 
 static GDataInputStream *load_file_stream (GFile *trace_file, GCancellable *cancellable, GError **error);
 static UhmMessage *load_file_iteration (GDataInputStream *input_stream, GUri *base_uri, GCancellable *cancellable, GError **error);
+static GBytes *load_file_mapping (GFile *trace_file);
+static UhmMessage *load_mapping_iteration (GBytes *trace_bytes, gsize *offset, GUri *base_uri);
+static UhmMessage *load_mapped_message (UhmServer *self, GUri *base_uri);
+static GBytes *trace_cache_lookup (UhmServer *self, const gchar *trace_file_uri, gchar **hosts);
 
 static void apply_expected_domain_names (UhmServer *self);
+static const gchar * const *message_get_sorted_query_parameters (UhmMessage *message);
+
+typedef struct {
+	GBytes *compiled_trace;  /* owned; the trace in the compiled format */
+	gchar *hosts;  /* owned; contents of the trace's hosts file, or %NULL if it has none */
+} CachedTrace;
+
+static void cached_trace_free (CachedTrace *cached_trace);
+
+typedef struct _TraceReader TraceReader;
+static void trace_reader_free (TraceReader *reader);
+
+/* Number of buckets in each timing histogram. Bucket 0 counts durations of less than 1µs, bucket i counts durations in [2^(i-1), 2^i)µs,
+ * and the last bucket also counts everything longer than that. */
+#define STATISTICS_HISTOGRAM_N_BUCKETS 24
+
+typedef struct {
+	guint64 count;
+	guint64 total_time;  /* microseconds */
+	guint64 max_time;  /* microseconds */
+	guint64 buckets[STATISTICS_HISTOGRAM_N_BUCKETS];
+} StatisticsHistogram;
 
 struct _UhmServerPrivate {
 	/* UhmServer is based around HTTP/HTTPS, and cannot be extended to support other application-layer protocols.
@@ -103,8 +131,35 @@ struct _UhmServerPrivate {
 	GMainContext *server_context;
 	GMainLoop *server_main_loop;
 
+	/* Additional worker threads, each running its own SoupServer in its own main context. These are only used if n_workers is greater
+	 * than 1. The server thread accepts connections on listen_socket (and listen_socket_ipv6, if IPv6 is available) and hands them out
+	 * to the workers (including its own SoupServer) in turn. */
+	guint n_workers;
+	GPtrArray/*<owned UhmServerWorker>*/ *workers;  /* owned */
+	GSocket *listen_socket;  /* owned */
+	GSource *accept_source;  /* owned */
+	GSocket *listen_socket_ipv6;  /* owned; NULL if listening on a Unix socket or if IPv6 isn't available */
+	GSource *accept_source_ipv6;  /* owned */
+	guint next_worker;  /* only accessed in the server thread */
+
+	/* If set (and n_workers is greater than 1), each worker listens on its own SO_REUSEPORT socket bound to the same port and accepts its
+	 * own connections, rather than the server thread handing them out. listen_socket is then only used by the server thread's SoupServer. */
+	gboolean enable_reuse_port;
+
+	/* If set, the server listens on this Unix socket (using listen_socket) rather than on TCP. */
+	gchar *unix_socket_path;  /* owned */
+
+	/* Protects all the trace state below which is used when handling messages (next_message, message_counter, etc.), as messages may be
+	 * handled in several worker threads. */
+	GMutex trace_lock;
+
+	/* Number of filters installed by uhm_server_filter_ignore_parameter_values(). While this is non-zero, the sorted query parameters of
+	 * each trace message are computed when it's loaded, rather than while handling requests. Accessed atomically. */
+	gint n_ignore_parameter_filters;
+
 	/* TLS certificate. */
 	GTlsCertificate *tls_certificate;
+	gboolean enable_http2;  /* whether to offer HTTP/2 using ALPN on TLS connections */
 
 	/* Server interface. */
 	GSocketAddress *address;  /* owned */
@@ -115,19 +170,58 @@ struct _UhmServerPrivate {
 	gchar **expected_domain_names;
 
 	GFile *trace_file;
-	GDataInputStream *input_stream;
-	GFileOutputStream *output_stream;
+	gchar *trace_file_uri;  /* owned; cache of the URI of trace_file */
+	GDataInputStream *input_stream;  /* only set if the trace file could not be mapped */
+	GBytes *trace_bytes;  /* owned; contents of the memory mapped trace file */
+	TraceReader *trace_reader;  /* owned; only set if the trace wasn't preloaded */
+	gsize trace_offset;  /* offset of the next message in trace_bytes */
+	gboolean trace_is_compiled;  /* whether trace_bytes is in the compiled trace format */
+	guint compiled_n_messages;
+	gsize compiled_index_offset;
+	guint compiled_next_index;  /* index of the next message to load from the compiled trace */
+	gsize compiled_offset;  /* offset of the end of the last message loaded from the compiled trace */
+	goffset trace_read_position;  /* how far through the trace file trace_bytes_read has been counted up to */
+	GOutputStream *output_stream;  /* owned; buffered */
 	UhmMessage *next_message;
 	guint message_counter; /* ID of the message within the current trace file */
 
+	/* Preloaded trace; only set if enable_preload was %TRUE when the trace was loaded. */
+	GPtrArray/*<owned UhmMessage>*/ *preloaded_messages;  /* owned */
+	guint preloaded_index;  /* index of the next message to take from preloaded_messages */
+
+	/* Unordered matching index; only set if enable_unordered_matching was %TRUE when the trace was loaded. unordered_messages holds all the
+	 * unconsumed messages in trace order, and unordered_index maps request keys (see build_request_key()) to queues of the links in
+	 * unordered_messages for the messages with that key, also in trace order. */
+	GQueue/*<owned UhmMessage>*/ *unordered_messages;  /* owned */
+	GHashTable/*<owned utf8, owned GQueue<unowned GList>>*/ *unordered_index;  /* owned */
+
 	GFile *trace_directory;
 	gboolean enable_online;
 	gboolean enable_logging;
+	gboolean enable_preload;
+	gboolean enable_unordered_matching;
+	gboolean enable_persistent_listener;
 
 	GFile *hosts_trace_file;
-	GFileOutputStream *hosts_output_stream;
+	GOutputStream *hosts_output_stream;  /* owned; buffered */
 	GHashTable *hosts;
 
+	/* Traces preloaded by uhm_server_preload_traces(), ready to be loaded without being read or parsed again. This is filled in by worker
+	 * threads, so must only be accessed with trace_cache_lock held. */
+	GMutex trace_cache_lock;
+	GHashTable/*<owned utf8, owned CachedTrace>*/ *trace_cache;  /* owned; keyed by trace file URI */
+
+	/* Statistics, as returned by uhm_server_get_statistics(). These are updated while handling messages in the worker threads. */
+	GMutex statistics_lock;
+	guint64 requests_handled;
+	guint64 mismatches;
+	guint64 trace_bytes_read;
+	guint64 bytes_written;
+	guint64 connections;
+	guint64 tls_handshakes;
+	StatisticsHistogram trace_fetch_time;
+	StatisticsHistogram compare_time;
+
 	GByteArray *comparison_message;
 	enum {
 		UNKNOWN,
@@ -138,6 +232,9 @@ struct _UhmServerPrivate {
 	} received_message_state;
 };
 
+/* Size of the buffer used when logging trace files. Traces are written out whenever this fills up, and when the trace is ended. */
+#define TRACE_OUTPUT_BUFFER_SIZE (64 * 1024)
+
 enum {
 	PROP_TRACE_DIRECTORY = 1,
 	PROP_ENABLE_ONLINE,
@@ -146,6 +243,13 @@ enum {
 	PROP_PORT,
 	PROP_RESOLVER,
 	PROP_TLS_CERTIFICATE,
+	PROP_ENABLE_PRELOAD,
+	PROP_ENABLE_UNORDERED_MATCHING,
+	PROP_N_WORKERS,
+	PROP_ENABLE_PERSISTENT_LISTENER,
+	PROP_UNIX_SOCKET_PATH,
+	PROP_ENABLE_REUSE_PORT,
+	PROP_ENABLE_HTTP2,
 };
 
 enum {
@@ -218,7 +322,8 @@ uhm_server_class_init (UhmServerClass *klass)
 	 * UhmServer:address:
 	 *
 	 * Address of the local mock server if it's running, or %NULL otherwise. This will be non-%NULL between calls to uhm_server_run() and
-	 * uhm_server_stop(). The address is a physical IP address, e.g. <code class="literal">127.0.0.1</code>.
+	 * uhm_server_stop(). The address is a physical IP address, e.g. <code class="literal">127.0.0.1</code>. It is %NULL if the server is listening on
+	 * a Unix socket (#UhmServer:unix-socket-path).
 	 *
 	 * This should not normally need to be passed into client code under test, unless the code references IP addresses specifically. The mock server
 	 * runs a DNS resolver which automatically redirects client requests for known domain names to this address (#UhmServer:resolver).
@@ -289,6 +394,159 @@ uhm_server_class_init (UhmServerClass *klass)
 	                                                      G_TYPE_TLS_CERTIFICATE,
 	                                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+	/**
+	 * UhmServer:enable-preload:
+	 *
+	 * %TRUE if trace files should be parsed in their entirety when they are loaded by uhm_server_load_trace(), rather than one message at a
+	 * time as requests are received. Preloading takes all trace file I/O and parsing off the request path, so the latency of replayed responses
+	 * does not depend on the disk or on the availability of threads in the GLib thread pool.
+	 *
+	 * Changes to this property only take effect on the next call to uhm_server_load_trace() or uhm_server_load_trace_async().
+	 *
+	 * Since: 0.12.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_ENABLE_PRELOAD,
+	                                 g_param_spec_boolean ("enable-preload",
+	                                                       "Enable Preload", "Whether trace files should be fully parsed when they are loaded.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:enable-unordered-matching:
+	 *
+	 * %TRUE if incoming requests may be matched against any unconsumed message in the trace file, rather than only against the next message
+	 * in it. This allows traces recorded from clients which issue requests concurrently (for example, over several connections, or
+	 * multiplexed over HTTP/2) to be replayed even if the requests arrive in a different order.
+	 *
+	 * Trace messages are indexed by their method, path and query, so looking up the message for a request takes constant time. If no
+	 * message with the same method, path and query matches the request, all unconsumed messages are tried in order, so that #UhmServer::compare-messages handlers which accept differing requests still work. If several messages match, the first
+	 * one in the trace is used. Each message is only used once.
+	 *
+	 * Unordered matching implies #UhmServer:enable-preload. It does not apply when comparing a trace against online traffic (with
+	 * #UhmServer:enable-online set and #UhmServer:enable-logging unset). Changes to this property only take effect on the next call to
+	 * uhm_server_load_trace() or uhm_server_load_trace_async().
+	 *
+	 * Since: 0.12.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_ENABLE_UNORDERED_MATCHING,
+	                                 g_param_spec_boolean ("enable-unordered-matching",
+	                                                       "Enable Unordered Matching", "Whether requests may be matched against trace messages out of order.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:n-workers:
+	 *
+	 * Number of threads to handle requests in. If this is greater than 1, the mock server accepts connections in its main thread and
+	 * distributes them between this many threads (including the main one), each running its own #GMainContext. Set
+	 * #UhmServer:enable-reuse-port to have each thread accept its own connections instead. Requests on different
+	 * connections may then be handled concurrently, sharing the loaded trace file. This is useful for load testing client code against
+	 * replayed traffic; #UhmServer:enable-unordered-matching is typically also needed in that case.
+	 *
+	 * If this is greater than 1, #UhmServer::handle-message and #UhmServer::compare-messages may be emitted in several threads at once,
+	 * so signal handlers must be thread safe.
+	 *
+	 * Changes to this property only take effect on the next call to uhm_server_run().
+	 *
+	 * Since: 0.12.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_N_WORKERS,
+	                                 g_param_spec_uint ("n-workers",
+	                                                    "Number of Workers", "Number of threads to handle requests in.",
+	                                                    1, 1024, 1,
+	                                                    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:enable-persistent-listener:
+	 *
+	 * %TRUE if the mock server should be kept running between traces when #UhmServer:enable-online is %FALSE. By default,
+	 * uhm_server_start_trace() runs the mock server with uhm_server_run() and uhm_server_end_trace() stops it with uhm_server_stop(), so each
+	 * trace gets a new socket, server thread and #UhmResolver. If this is %TRUE, the server is only started by the first trace, and later
+	 * calls to uhm_server_start_trace() and uhm_server_end_trace() just load and unload their traces, keeping the same #UhmServer:address,
+	 * #UhmServer:port and #UhmServer:resolver. This makes test suites with many short tests much quicker.
+	 *
+	 * Between traces, the #UhmServer:resolver is reset to contain only the domain names set with uhm_server_set_expected_domain_names(), and
+	 * the hosts from the next trace file are then added to it. #GObject::notify is not emitted for #UhmServer:resolver.
+	 *
+	 * The server must be shut down explicitly using uhm_server_stop() once it's no longer needed.
+	 *
+	 * Since: 0.12.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_ENABLE_PERSISTENT_LISTENER,
+	                                 g_param_spec_boolean ("enable-persistent-listener",
+	                                                       "Enable Persistent Listener", "Whether to keep the mock server running between traces.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:unix-socket-path:
+	 *
+	 * Path of a Unix domain socket for the mock server to listen on, instead of listening on a random TCP port on the loopback interface.
+	 * If the path starts with <literal>@</literal>, the rest of it is used as the name of a socket in the abstract namespace, on systems
+	 * which support that. Otherwise, the socket is deleted again when the server is stopped. Nothing must exist at the path when the server
+	 * is started, apart from a stale socket which nothing is listening on (for example, one left behind by a test process which crashed),
+	 * which is replaced.
+	 *
+	 * When listening on a Unix socket, #UhmServer:address is %NULL and #UhmServer:port is <code class="literal">0</code>, and the
+	 * #UhmServer:resolver isn't used, as clients connect to the socket directly. Pass the #GSocketConnectable returned by
+	 * uhm_server_get_connectable() to client code as the #SoupSession:remote-connectable for its #SoupSession.
+	 *
+	 * Changes to this property only take effect on the next call to uhm_server_run().
+	 *
+	 * Since: 0.12.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_UNIX_SOCKET_PATH,
+	                                 g_param_spec_string ("unix-socket-path",
+	                                                      "Unix Socket Path", "Path of a Unix domain socket to listen on instead of TCP.",
+	                                                      NULL,
+	                                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:enable-reuse-port:
+	 *
+	 * %TRUE if each of the #UhmServer:n-workers threads should listen on its own socket, rather than the main thread accepting all the
+	 * connections and distributing them. The sockets are all bound to the same port with <code class="literal">SO_REUSEPORT</code>, so the
+	 * kernel spreads incoming connections between them, and accepting connections isn't limited to one thread. This is useful when
+	 * stress testing client code with large numbers of short-lived connections.
+	 *
+	 * This has no effect if #UhmServer:n-workers is 1 or #UhmServer:unix-socket-path is set. If the system doesn't support
+	 * <code class="literal">SO_REUSEPORT</code>, the server falls back to accepting connections in its main thread.
+	 *
+	 * Changes to this property only take effect on the next call to uhm_server_run().
+	 *
+	 * Since: 0.12.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_ENABLE_REUSE_PORT,
+	                                 g_param_spec_boolean ("enable-reuse-port",
+	                                                       "Enable Reuse Port", "Whether each worker thread should accept connections on its own socket.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:enable-http2:
+	 *
+	 * %TRUE if the mock server should offer HTTP/2 to clients, using ALPN when setting up TLS on each connection. Clients which support
+	 * HTTP/2 can then send all their requests concurrently over a single connection, as they would to a production server. This has no
+	 * effect unless #UhmServer:tls-certificate is set, as HTTP/2 without TLS isn't supported.
+	 *
+	 * libsoup has no API to enable HTTP/2 in a #SoupServer: it only speaks HTTP/2 if the <envar>SOUP_SERVER_HTTP2</envar> environment
+	 * variable is set. As the environment can't safely be changed once a process has started any threads, callers must set
+	 * <envar>SOUP_SERVER_HTTP2</envar> themselves (for example, when running the test program); otherwise, clients which negotiate
+	 * HTTP/2 won't be able to talk to the server.
+	 *
+	 * Responses to HTTP/2 requests are always sent as HTTP/2, whichever HTTP version the trace file gives for them, and connection-specific
+	 * headers such as <literal>Transfer-Encoding</literal> are omitted from them.
+	 *
+	 * Changes to this property only take effect on the next call to uhm_server_run().
+	 *
+	 * Since: 0.12.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_ENABLE_HTTP2,
+	                                 g_param_spec_boolean ("enable-http2",
+	                                                       "Enable HTTP/2", "Whether to offer HTTP/2 to clients connecting using TLS.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
 	/**
 	 * UhmServer::handle-message:
 	 * @self: a #UhmServer
@@ -337,6 +595,20 @@ uhm_server_init (UhmServer *self)
 {
 	self->priv = uhm_server_get_instance_private (self);
 	self->priv->hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	self->priv->n_workers = 1;
+	g_mutex_init (&self->priv->trace_lock);
+	g_mutex_init (&self->priv->statistics_lock);
+	g_mutex_init (&self->priv->trace_cache_lock);
+	self->priv->trace_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) cached_trace_free);
+}
+
+static void
+unordered_messages_free (UhmServerPrivate *priv)
+{
+	if (priv->unordered_messages != NULL) {
+		g_queue_free_full (priv->unordered_messages, g_object_unref);
+		priv->unordered_messages = NULL;
+	}
 }
 
 static void
@@ -347,17 +619,24 @@ uhm_server_dispose (GObject *object)
 	g_clear_object (&priv->resolver);
 	g_clear_object (&priv->server);
 	g_clear_pointer (&priv->server_context, g_main_context_unref);
+	g_clear_pointer (&priv->trace_reader, trace_reader_free);
 	g_clear_pointer (&priv->hosts, g_hash_table_unref);
 	g_clear_object (&priv->hosts_trace_file);
 	g_clear_object (&priv->hosts_output_stream);
 	g_clear_object (&priv->trace_file);
+	g_clear_pointer (&priv->trace_file_uri, g_free);
 	g_clear_object (&priv->input_stream);
+	g_clear_pointer (&priv->trace_bytes, g_bytes_unref);
 	g_clear_object (&priv->output_stream);
 	g_clear_object (&priv->next_message);
+	g_clear_pointer (&priv->preloaded_messages, g_ptr_array_unref);
+	g_clear_pointer (&priv->unordered_index, g_hash_table_unref);
+	unordered_messages_free (priv);
 	g_clear_object (&priv->trace_directory);
 	g_clear_pointer (&priv->server_thread, g_thread_unref);
 	g_clear_pointer (&priv->comparison_message, g_byte_array_unref);
 	g_clear_object (&priv->tls_certificate);
+	g_clear_pointer (&priv->trace_cache, g_hash_table_unref);
 
 	/* Chain up to the parent class */
 	G_OBJECT_CLASS (uhm_server_parent_class)->dispose (object);
@@ -369,6 +648,10 @@ uhm_server_finalize (GObject *object)
 	UhmServerPrivate *priv = UHM_SERVER (object)->priv;
 
 	g_strfreev (priv->expected_domain_names);
+	g_free (priv->unix_socket_path);
+	g_mutex_clear (&priv->trace_lock);
+	g_mutex_clear (&priv->statistics_lock);
+	g_mutex_clear (&priv->trace_cache_lock);
 
 	/* Chain up to the parent class */
 	G_OBJECT_CLASS (uhm_server_parent_class)->finalize (object);
@@ -401,6 +684,27 @@ uhm_server_get_property (GObject *object, guint property_id, GValue *value, GPar
 		case PROP_TLS_CERTIFICATE:
 			g_value_set_object (value, priv->tls_certificate);
 			break;
+		case PROP_ENABLE_PRELOAD:
+			g_value_set_boolean (value, priv->enable_preload);
+			break;
+		case PROP_ENABLE_UNORDERED_MATCHING:
+			g_value_set_boolean (value, priv->enable_unordered_matching);
+			break;
+		case PROP_N_WORKERS:
+			g_value_set_uint (value, priv->n_workers);
+			break;
+		case PROP_ENABLE_PERSISTENT_LISTENER:
+			g_value_set_boolean (value, priv->enable_persistent_listener);
+			break;
+		case PROP_UNIX_SOCKET_PATH:
+			g_value_set_string (value, priv->unix_socket_path);
+			break;
+		case PROP_ENABLE_REUSE_PORT:
+			g_value_set_boolean (value, priv->enable_reuse_port);
+			break;
+		case PROP_ENABLE_HTTP2:
+			g_value_set_boolean (value, priv->enable_http2);
+			break;
 		default:
 			/* We don't have any other property... */
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -426,6 +730,27 @@ uhm_server_set_property (GObject *object, guint property_id, const GValue *value
 		case PROP_TLS_CERTIFICATE:
 			uhm_server_set_tls_certificate (self, g_value_get_object (value));
 			break;
+		case PROP_ENABLE_PRELOAD:
+			uhm_server_set_enable_preload (self, g_value_get_boolean (value));
+			break;
+		case PROP_ENABLE_UNORDERED_MATCHING:
+			uhm_server_set_enable_unordered_matching (self, g_value_get_boolean (value));
+			break;
+		case PROP_N_WORKERS:
+			uhm_server_set_n_workers (self, g_value_get_uint (value));
+			break;
+		case PROP_ENABLE_PERSISTENT_LISTENER:
+			uhm_server_set_enable_persistent_listener (self, g_value_get_boolean (value));
+			break;
+		case PROP_UNIX_SOCKET_PATH:
+			uhm_server_set_unix_socket_path (self, g_value_get_string (value));
+			break;
+		case PROP_ENABLE_REUSE_PORT:
+			uhm_server_set_enable_reuse_port (self, g_value_get_boolean (value));
+			break;
+		case PROP_ENABLE_HTTP2:
+			uhm_server_set_enable_http2 (self, g_value_get_boolean (value));
+			break;
 		case PROP_ADDRESS:
 		case PROP_PORT:
 		case PROP_RESOLVER:
@@ -440,6 +765,7 @@ uhm_server_set_property (GObject *object, guint property_id, const GValue *value
 typedef struct {
 	GDataInputStream *input_stream;
 	GUri *base_uri;
+	gboolean preload;  /* whether to load all the remaining messages, rather than just the next one */
 } LoadFileIterationData;
 
 static void
@@ -464,7 +790,14 @@ build_base_uri (UhmServer *self)
 	gchar *base_uri_string;
 	GUri *base_uri;
 
-	if (priv->enable_online == FALSE) {
+	if (priv->enable_online == FALSE && G_IS_UNIX_SOCKET_ADDRESS (priv->address)) {
+		/* Clients connect to the socket directly, so the host name doesn't matter. */
+		base_uri_string = g_strdup_printf ("%s://localhost", (priv->tls_certificate != NULL) ? "https" : "http");
+	} else if (priv->enable_online == FALSE && priv->listen_socket != NULL) {
+		/* The SoupServer doesn't listen itself; see uhm_server_run(). */
+		base_uri_string = g_strdup_printf ("%s://%s:%u", (priv->tls_certificate != NULL) ? "https" : "http",
+		                                   uhm_server_get_address (self), priv->port);
+	} else if (priv->enable_online == FALSE) {
 		GSList *uris;  /* owned */
 		uris = soup_server_get_uris (priv->server);
 		if (uris == NULL) {
@@ -517,840 +850,3060 @@ real_compare_messages (UhmServer *server, UhmMessage *expected_message, UhmMessa
 	return TRUE;
 }
 
-/* strcmp()-like return value: 0 means the messages compare equal. */
-static gint
-compare_incoming_message (UhmServer *self, UhmMessage *expected_message, UhmMessage *actual_message)
+static void
+statistics_histogram_add (StatisticsHistogram *histogram, guint64 duration)
 {
-	gboolean messages_equal = FALSE;
+	guint bucket = 0;
 
-	g_signal_emit (self, signals[SIGNAL_COMPARE_MESSAGES], 0, expected_message, actual_message, &messages_equal);
+	while (bucket < STATISTICS_HISTOGRAM_N_BUCKETS - 1 && duration >= ((guint64) 1 << bucket)) {
+		bucket++;
+	}
 
-	return (messages_equal == TRUE) ? 0 : 1;
+	histogram->count++;
+	histogram->total_time += duration;
+	histogram->max_time = MAX (histogram->max_time, duration);
+	histogram->buckets[bucket]++;
 }
 
+/* Adds the time elapsed since @start_time (from g_get_monotonic_time()) to @histogram, which must be one of the server's histograms. */
 static void
-header_append_cb (const gchar *name, const gchar *value, gpointer user_data)
+statistics_add_time (UhmServer *self, StatisticsHistogram *histogram, gint64 start_time)
 {
-	UhmMessage *message = user_data;
+	gint64 duration = g_get_monotonic_time () - start_time;
 
-	soup_message_headers_append (uhm_message_get_response_headers (message), name, value);
+	g_mutex_lock (&self->priv->statistics_lock);
+	statistics_histogram_add (histogram, MAX (duration, 0));
+	g_mutex_unlock (&self->priv->statistics_lock);
 }
 
+/* Counts a new client connection. This is called when connections are accepted, before any TLS handshake. */
 static void
-server_response_append_headers (UhmServer *self, UhmMessage *message)
+statistics_add_connection (UhmServer *self)
 {
-	UhmServerPrivate *priv = self->priv;
-	gchar *trace_file_name, *trace_file_offset;
-
-	trace_file_name = g_file_get_uri (priv->trace_file);
-	soup_message_headers_append (uhm_message_get_response_headers (message), "X-Mock-Trace-File", trace_file_name);
-	g_free (trace_file_name);
+	g_mutex_lock (&self->priv->statistics_lock);
+	self->priv->connections++;
+	g_mutex_unlock (&self->priv->statistics_lock);
+}
 
-	trace_file_offset = g_strdup_printf ("%u", priv->message_counter);
-	soup_message_headers_append (uhm_message_get_response_headers (message), "X-Mock-Trace-File-Offset", trace_file_offset);
-	g_free (trace_file_offset);
+/* Counts a successfully completed TLS handshake. GIO doesn't expose whether a handshake resumed a previous TLS session, so resumed
+ * handshakes can't be counted separately. */
+static void
+statistics_add_tls_handshake (UhmServer *self)
+{
+	g_mutex_lock (&self->priv->statistics_lock);
+	self->priv->tls_handshakes++;
+	g_mutex_unlock (&self->priv->statistics_lock);
 }
 
+/* Adds the trace data which has been read since this was last called to the trace-bytes-read statistic. Must be called with the trace lock
+ * held, or while loading the trace. */
 static void
-server_process_message (UhmServer *self, UhmMessage *message)
+statistics_update_trace_bytes_read (UhmServer *self)
 {
 	UhmServerPrivate *priv = self->priv;
-	g_autoptr(GBytes) message_body = NULL;
-	goffset expected_content_length;
-	g_autoptr(GError) error = NULL;
-	const char *location_header = NULL;
-
-	g_assert (priv->next_message != NULL);
-	priv->message_counter++;
-
-	if (compare_incoming_message (self, priv->next_message, message) != 0) {
-		gchar *body, *next_uri, *actual_uri;
-
-		/* Received message is not what we expected. Return an error. */
-		uhm_message_set_status (message, SOUP_STATUS_BAD_REQUEST,
-		                        "Unexpected request to mock server");
-
-		next_uri = uri_get_path_query (uhm_message_get_uri (priv->next_message));
-		actual_uri = uri_get_path_query (uhm_message_get_uri (message));
-		body = g_strdup_printf ("Expected %s URI ‘%s’, but got %s ‘%s’.",
-		                        uhm_message_get_method (priv->next_message),
-		                        next_uri, uhm_message_get_method (message), actual_uri);
-		g_free (actual_uri);
-		g_free (next_uri);
-		soup_message_body_append_take (uhm_message_get_response_body (message), (guchar *) body, strlen (body) + 1);
-
-		server_response_append_headers (self, message);
+	goffset position;
 
+	if (priv->trace_bytes != NULL) {
+		position = (priv->trace_is_compiled == TRUE) ? (goffset) priv->compiled_offset : (goffset) priv->trace_offset;
+	} else if (priv->input_stream != NULL && G_IS_SEEKABLE (priv->input_stream)) {
+		position = g_seekable_tell (G_SEEKABLE (priv->input_stream));
+	} else {
 		return;
 	}
 
-	/* The incoming message matches what we expected, so copy the headers and body from the expected response and return it. */
-	uhm_message_set_http_version (message, uhm_message_get_http_version (priv->next_message));
-	uhm_message_set_status (message, uhm_message_get_status (priv->next_message),
-	                        uhm_message_get_reason_phrase (priv->next_message));
+	if (position > priv->trace_read_position) {
+		g_mutex_lock (&priv->statistics_lock);
+		priv->trace_bytes_read += position - priv->trace_read_position;
+		g_mutex_unlock (&priv->statistics_lock);
 
-	/* Rewrite Location headers to use the uhttpmock server details */
-	location_header = soup_message_headers_get_one (uhm_message_get_response_headers (priv->next_message), "Location");
-	if (location_header) {
-		g_autoptr(GUri) uri = NULL;
-		g_autoptr(GUri) modified_uri = NULL;
-		g_autofree char *uri_str = NULL;
-
-		uri = g_uri_parse (location_header, G_URI_FLAGS_ENCODED, &error);
-		if (uri) {
-			modified_uri = g_uri_build (G_URI_FLAGS_ENCODED,
-				                    g_uri_get_scheme (uri),
-				                    g_uri_get_userinfo (uri),
-				                    g_uri_get_host (uri),
-				                    priv->port,
-				                    g_uri_get_path (uri),
-				                    g_uri_get_query (uri),
-				                    g_uri_get_fragment (uri));
-
-			uri_str = g_uri_to_string (modified_uri);
-			soup_message_headers_replace (uhm_message_get_response_headers (priv->next_message), "Location", uri_str);
-		} else {
-			g_debug ("Failed to rewrite Location header ‘%s’ to use new port", location_header);
-		}
+		priv->trace_read_position = position;
 	}
-	soup_message_headers_foreach (uhm_message_get_response_headers (priv->next_message), header_append_cb, message);
-
-	/* Add debug headers to identify the message and trace file. */
-	server_response_append_headers (self, message);
+}
 
-	message_body = soup_message_body_flatten (uhm_message_get_response_body (priv->next_message));
-	if (g_bytes_get_size (message_body) > 0)
-		soup_message_body_append_bytes (uhm_message_get_response_body (message), message_body);
+/* strcmp()-like return value: 0 means the messages compare equal. */
+static gint
+compare_incoming_message (UhmServer *self, UhmMessage *expected_message, UhmMessage *actual_message)
+{
+	gboolean messages_equal = FALSE;
+	gint64 start_time;
 
-	/* If the log file doesn't contain the full response body (e.g. because it's a huge binary file containing a nul byte somewhere),
-	 * make one up (all zeros). */
-	expected_content_length = soup_message_headers_get_content_length (uhm_message_get_response_headers (message));
-	if (expected_content_length > 0 && g_bytes_get_size (message_body) < (gsize) expected_content_length) {
-		guint8 *buf;
+	start_time = g_get_monotonic_time ();
 
-		buf = g_malloc0 (expected_content_length - g_bytes_get_size (message_body));
-		soup_message_body_append_take (uhm_message_get_response_body (message), buf, expected_content_length - g_bytes_get_size (message_body));
+	if (UHM_SERVER_GET_CLASS (self)->compare_messages == real_compare_messages &&
+	    !g_signal_has_handler_pending (self, signals[SIGNAL_COMPARE_MESSAGES], 0, FALSE)) {
+		/* Only the default handler would be run, so avoid emitting the signal. Messages with different fingerprints can't compare
+		 * equal; ones with the same fingerprint are compared in full, in case of collisions. */
+		messages_equal = (uhm_message_get_fingerprint (expected_message) == uhm_message_get_fingerprint (actual_message) &&
+		                  real_compare_messages (self, expected_message, actual_message));
+	} else {
+		g_signal_emit (self, signals[SIGNAL_COMPARE_MESSAGES], 0, expected_message, actual_message, &messages_equal);
 	}
 
-	soup_message_body_complete (uhm_message_get_response_body (message));
+	statistics_add_time (self, &self->priv->compare_time, start_time);
 
-	/* Clear the expected message. */
-	g_clear_object (&priv->next_message);
+	return (messages_equal == TRUE) ? 0 : 1;
 }
 
 static void
-server_handler_cb (SoupServer *server, SoupServerMessage *message, const gchar *path, GHashTable *query, gpointer user_data)
+server_response_append_offset_header (UhmMessage *message, guint message_counter)
 {
-	UhmServer *self = user_data;
-	UhmMessage *umsg;
-	gboolean message_handled = FALSE;
+	gchar trace_file_offset[16];
 
-	soup_server_message_pause (message);
-	umsg = uhm_message_new_from_server_message (message);
+	g_snprintf (trace_file_offset, sizeof (trace_file_offset), "%u", message_counter);
+	soup_message_headers_append (uhm_message_get_response_headers (message), "X-Mock-Trace-File-Offset", trace_file_offset);
+}
 
-	g_signal_emit (self, signals[SIGNAL_HANDLE_MESSAGE], 0, umsg, &message_handled);
+/* Add debug headers to identify the message and trace file to an error response. Responses from the trace already have the
+ * X-Mock-Trace-File header; see bind_trace_message(). */
+static void
+server_response_append_headers (UhmServer *self, UhmMessage *message, guint message_counter)
+{
+	soup_message_headers_append (uhm_message_get_response_headers (message), "X-Mock-Trace-File", self->priv->trace_file_uri);
+	server_response_append_offset_header (message, message_counter);
+}
 
-	soup_server_message_set_http_version (message, uhm_message_get_http_version (umsg));
-	soup_server_message_set_status (message, uhm_message_get_status (umsg), uhm_message_get_reason_phrase (umsg));
+/* Rewrites the Location header in the response in @message (from the trace file) to use the uhttpmock server's @port, unless it's already
+ * been rewritten for @port. */
+static void
+rewrite_location_header (UhmMessage *message, guint port)
+{
+	GQuark quark = g_quark_from_static_string ("uhm-location-port");
+	const char *location_header;
+	g_autoptr(GUri) uri = NULL;
+	g_autoptr(GUri) modified_uri = NULL;
+	g_autofree char *uri_str = NULL;
 
-	g_object_unref (umsg);
-	soup_server_message_unpause (message);
+	location_header = soup_message_headers_get_one (uhm_message_get_response_headers (message), "Location");
+	if (location_header == NULL || GPOINTER_TO_UINT (g_object_get_qdata (G_OBJECT (message), quark)) == port) {
+		return;
+	}
 
-	/* The message should always be handled by real_handle_message() at least. */
-	g_assert (message_handled == TRUE);
+	uri = g_uri_parse (location_header, G_URI_FLAGS_ENCODED, NULL);
+	if (uri) {
+		modified_uri = g_uri_build (G_URI_FLAGS_ENCODED,
+		                            g_uri_get_scheme (uri),
+		                            g_uri_get_userinfo (uri),
+		                            g_uri_get_host (uri),
+		                            port,
+		                            g_uri_get_path (uri),
+		                            g_uri_get_query (uri),
+		                            g_uri_get_fragment (uri));
+
+		uri_str = g_uri_to_string (modified_uri);
+		soup_message_headers_replace (uhm_message_get_response_headers (message), "Location", uri_str);
+	} else {
+		g_debug ("Failed to rewrite Location header ‘%s’ to use new port", location_header);
+	}
+
+	/* Don't try again, whether or not it succeeded. */
+	g_object_set_qdata (G_OBJECT (message), quark, GUINT_TO_POINTER (port));
 }
 
-static gboolean
-real_handle_message (UhmServer *self, UhmMessage *message)
+/* Prepares @message, which has just been loaded from the current trace, to be replayed by the server listening on @port (or 0 if it's not
+ * running). Its response headers are completed with those which are the same every time it's replayed, and any headers which refer to the
+ * server are rewritten, so they can just be copied when responding with it. This is called when loading the trace, or from the trace
+ * reader thread, rather than while handling requests. */
+static void
+bind_trace_message (UhmServer *self, UhmMessage *message, guint port)
 {
-	UhmServerPrivate *priv = self->priv;
-	gboolean handled = FALSE;
-
-	/* Asynchronously load the next expected message from the trace file. */
-	if (priv->next_message == NULL) {
-		GTask *task;
-		LoadFileIterationData *data;
-		GError *child_error = NULL;
+	soup_message_headers_append (uhm_message_get_response_headers (message), "X-Mock-Trace-File", self->priv->trace_file_uri);
 
-		data = g_slice_new (LoadFileIterationData);
-		data->input_stream = g_object_ref (priv->input_stream);
-		data->base_uri = build_base_uri (self);
+	/* Rewrite Location headers to use the uhttpmock server details */
+	if (port != 0) {
+		rewrite_location_header (message, port);
+	}
 
-		task = g_task_new (self, NULL, NULL, NULL);
-		g_task_set_task_data (task, data, (GDestroyNotify) load_file_iteration_data_free);
-		g_task_run_in_thread_sync (task, load_file_iteration_thread_cb);
+	/* Only the incoming request's query should need decoding when comparing it against @message. */
+	if (g_atomic_int_get (&self->priv->n_ignore_parameter_filters) > 0) {
+		message_get_sorted_query_parameters (message);
+	}
+}
 
-		/* Handle the results. */
-		priv->next_message = g_task_propagate_pointer (task, &child_error);
+/* As bind_trace_message(), for all the messages in @messages. */
+static void
+bind_trace_messages (UhmServer *self, GPtrArray *messages, guint port)
+{
+	guint i;
 
-		g_object_unref (task);
+	for (i = 0; i < messages->len; i++) {
+		bind_trace_message (self, g_ptr_array_index (messages, i), port);
+	}
+}
 
-		if (child_error != NULL) {
-			gchar *body;
+/* Size of the chunks of zeros used to fill out response bodies which weren't fully logged. */
+#define ZERO_FILL_CHUNK_SIZE (64 * 1024)
 
-			uhm_message_set_status (message, SOUP_STATUS_INTERNAL_SERVER_ERROR,
-			                        "Error loading expected request");
+static const guint8 zero_fill_chunk[ZERO_FILL_CHUNK_SIZE] = { 0, };
 
-			body = g_strdup_printf ("Error: %s", child_error->message);
-			soup_message_body_append_take (uhm_message_get_response_body (message), (guchar *) body, strlen (body) + 1);
-			handled = TRUE;
+/* State for writing a response body from the trace, followed by zero_fill_length zero bytes. */
+typedef struct {
+	SoupMessageBody *trace_body;  /* owned */
+	goffset trace_body_offset;
+	goffset zero_fill_length;  /* number of zero bytes still to be appended */
+	gboolean completed;
+} ResponseStream;
 
-			g_error_free (child_error);
+static void
+response_stream_free (ResponseStream *stream, GClosure *closure)
+{
+	soup_message_body_unref (stream->trace_body);
+	g_slice_free (ResponseStream, stream);
+}
 
-			server_response_append_headers (self, message);
-		} else if (priv->next_message == NULL) {
-			gchar *body, *actual_uri;
+/* Appends the next chunk of the response to @response_body, or completes @response_body if there's nothing left to append. Chunks of the
+ * trace body are referenced rather than copied, and zero-filling uses a static buffer. */
+static void
+response_stream_append_next_chunk (ResponseStream *stream, SoupMessageBody *response_body)
+{
+	g_autoptr(GBytes) chunk = NULL;
 
-			/* Received message is not what we expected. Return an error. */
-			uhm_message_set_status (message, SOUP_STATUS_BAD_REQUEST,
-			                        "Unexpected request to mock server");
+	if (stream->completed == TRUE) {
+		return;
+	}
 
-			actual_uri = uri_get_path_query (uhm_message_get_uri (message));
-			body = g_strdup_printf ("Expected no request, but got %s ‘%s’.", uhm_message_get_method (message), actual_uri);
-			g_free (actual_uri);
-			soup_message_body_append_take (uhm_message_get_response_body (message), (guchar *) body, strlen (body) + 1);
-			handled = TRUE;
+	chunk = soup_message_body_get_chunk (stream->trace_body, stream->trace_body_offset);
 
-			server_response_append_headers (self, message);
-		}
-	}
+	if (chunk != NULL && g_bytes_get_size (chunk) > 0) {
+		stream->trace_body_offset += g_bytes_get_size (chunk);
+		soup_message_body_append_bytes (response_body, chunk);
+	} else if (stream->zero_fill_length > 0) {
+		gsize chunk_length = MIN (stream->zero_fill_length, ZERO_FILL_CHUNK_SIZE);
 
-	/* Process the actual message if we already know the expected message. */
-	g_assert (priv->next_message != NULL || handled == TRUE);
-	if (handled == FALSE) {
-		server_process_message (self, message);
-		handled = TRUE;
+		g_clear_pointer (&chunk, g_bytes_unref);
+		chunk = g_bytes_new_static (zero_fill_chunk, chunk_length);
+		stream->zero_fill_length -= chunk_length;
+		soup_message_body_append_bytes (response_body, chunk);
+	} else {
+		soup_message_body_complete (response_body);
+		stream->completed = TRUE;
 	}
-
-	g_assert (handled == TRUE);
-	return handled;
 }
 
-/**
- * uhm_server_new:
- *
- * Creates a new #UhmServer with default properties.
- *
- * Return value: (transfer full): a new #UhmServer; unref with g_object_unref()
- *
- * Since: 0.1.0
- */
-UhmServer *
-uhm_server_new (void)
+static void
+response_stream_write_next_chunk_cb (SoupServerMessage *server_message, ResponseStream *stream)
 {
-	return g_object_new (UHM_TYPE_SERVER, NULL);
+	response_stream_append_next_chunk (stream, soup_server_message_get_response_body (server_message));
 }
 
+/* Returns %TRUE if @header_name is a connection-specific header, which mustn't be sent over HTTP/2 (RFC 9113, section 8.2.2). */
 static gboolean
-trace_to_soup_message_headers_and_body (SoupMessageHeaders *message_headers, SoupMessageBody *message_body, const gchar message_direction, const gchar **_trace)
+header_is_connection_specific (const gchar *header_name)
 {
-	const gchar *i;
-	const gchar *trace = *_trace;
-
-	/* Parse headers. */
-	while (TRUE) {
-		gchar *header_name, *header_value;
-
-		if (*trace == '\0') {
-			/* No body. */
-			goto done;
-		} else if (*trace == ' ' && *(trace + 1) == ' ' && *(trace + 2) == '\n') {
-			/* No body. */
-			trace += 3;
-			goto done;
-		} else if (*trace != message_direction || *(trace + 1) != ' ') {
-			g_warning ("Unrecognised start sequence ‘%c%c’.", *trace, *(trace + 1));
-			goto error;
-		}
-		trace += 2;
+	const gchar *connection_specific_headers[] = { "Connection", "Keep-Alive", "Proxy-Connection", "Transfer-Encoding", "Upgrade" };
+	guint i;
 
-		if (*trace == '\n') {
-			/* Reached the end of the headers. */
-			trace++;
-			break;
+	for (i = 0; i < G_N_ELEMENTS (connection_specific_headers); i++) {
+		if (g_ascii_strcasecmp (header_name, connection_specific_headers[i]) == 0) {
+			return TRUE;
 		}
+	}
 
-		i = strchr (trace, ':');
-		if (i == NULL || *(i + 1) != ' ') {
-			g_warning ("Missing spacer ‘: ’.");
-			goto error;
-		}
+	return FALSE;
+}
 
-		header_name = g_strndup (trace, i - trace);
-		trace += (i - trace) + 2;
+/* Copy the status, headers and body of the response in @expected_message (from the trace file) to @message. */
+static void
+server_respond_from_trace (UhmServer *self, UhmMessage *message, UhmMessage *expected_message, guint message_counter)
+{
+	UhmServerPrivate *priv = self->priv;
+	ResponseStream *stream;
+	SoupServerMessage *server_message;
+	goffset expected_content_length;
+	SoupMessageHeadersIter headers_iter;
+	const char *header_name, *header_value;
+	gboolean is_http2;
 
-		i = strchr (trace, '\n');
-		if (i == NULL) {
-			g_warning ("Missing spacer ‘\\n’.");
-			goto error;
-		}
+	/* A response can only be sent in the HTTP version of the connection the request arrived on. Responses recorded over HTTP/1.x are
+	 * replayed over HTTP/2 as-is, apart from the version; see UhmServer:enable-http2. */
+	is_http2 = (uhm_message_get_http_version (message) == SOUP_HTTP_2_0);
 
-		header_value = g_strndup (trace, i - trace);
-		trace += (i - trace) + 1;
+	if (is_http2 == FALSE) {
+		uhm_message_set_http_version (message, uhm_message_get_http_version (expected_message));
+	}
 
-		/* Append the header. */
-		soup_message_headers_append (message_headers, header_name, header_value);
+	uhm_message_set_status (message, uhm_message_get_status (expected_message),
+	                        uhm_message_get_reason_phrase (expected_message));
 
-		g_free (header_value);
-		g_free (header_name);
-	}
+	/* The Location header is normally rewritten when the message is loaded, but the server might not have been running then. */
+	rewrite_location_header (expected_message, priv->port);
+	/* Copy the headers, including the X-Mock-Trace-File debug header added by bind_trace_message(), and add the debug header identifying
+	 * the message. */
+	soup_message_headers_iter_init (&headers_iter, uhm_message_get_response_headers (expected_message));
 
-	/* Parse the body. */
-	while (TRUE) {
-		if (*trace == ' ' && *(trace + 1) == ' ' && *(trace + 2) == '\n') {
-			/* End of the body. */
-			trace += 3;
-			break;
-		} else if (*trace == '\0') {
-			/* End of the body. */
-			break;
-		} else if (*trace != message_direction || *(trace + 1) != ' ') {
-			g_warning ("Unrecognised start sequence ‘%c%c’.", *trace, *(trace + 1));
-			goto error;
+	while (soup_message_headers_iter_next (&headers_iter, &header_name, &header_value)) {
+		if (is_http2 == TRUE && header_is_connection_specific (header_name) == TRUE) {
+			continue;
 		}
-		trace += 2;
 
-		i = strchr (trace, '\n');
-		if (i == NULL) {
-			g_warning ("Missing spacer ‘\\n’.");
-			goto error;
-		}
+		soup_message_headers_append (uhm_message_get_response_headers (message), header_name, header_value);
+	}
 
-		soup_message_body_append (message_body, SOUP_MEMORY_COPY, trace, i - trace + 1); /* include trailing \n */
-		trace += (i - trace) + 1;
+	server_response_append_offset_header (message, message_counter);
+
+	stream = g_slice_new0 (ResponseStream);
+	stream->trace_body = soup_message_body_ref (uhm_message_get_response_body (expected_message));
+
+	/* If the log file doesn't contain the full response body (e.g. because it's a huge binary file containing a nul byte somewhere),
+	 * make one up (all zeros). */
+	expected_content_length = soup_message_headers_get_content_length (uhm_message_get_response_headers (message));
+	if (expected_content_length > stream->trace_body->length) {
+		stream->zero_fill_length = expected_content_length - stream->trace_body->length;
 	}
 
-done:
-	/* Done. Update the output trace pointer. */
-	soup_message_body_complete (message_body);
-	*_trace = trace;
+	server_message = uhm_message_get_server_message (message);
 
-	return TRUE;
+	if (server_message != NULL) {
+		/* Stream the body to the client a chunk at a time, appending each chunk once the previous one has been written and then
+		 * discarding it. This keeps memory usage constant however long the response is. */
+		soup_message_body_set_accumulate (uhm_message_get_response_body (message), FALSE);
 
-error:
-	return FALSE;
+		g_signal_connect (server_message, "wrote-headers", (GCallback) response_stream_write_next_chunk_cb, stream);
+		g_signal_connect_data (server_message, "wrote-chunk", (GCallback) response_stream_write_next_chunk_cb, stream,
+		                       (GClosureNotify) response_stream_free, 0);
+	} else {
+		while (stream->completed == FALSE) {
+			response_stream_append_next_chunk (stream, uhm_message_get_response_body (message));
+		}
+
+		response_stream_free (stream, NULL);
+	}
 }
 
-/* base_uri is the base URI for the server, e.g. https://127.0.0.1:1431. */
+/* Compares @message against the next expected message. If they match, the expected message is returned, and should be responded with.
+ * Otherwise, an error response is set on @message and %NULL is returned. Must be called with the trace lock held. */
 static UhmMessage *
-trace_to_soup_message (const gchar *trace, GUri *base_uri)
+server_take_next_message (UhmServer *self, UhmMessage *message, guint *message_counter)
 {
-	UhmMessage *message = NULL;
-	const gchar *i, *j, *method;
-	gchar *uri_string, *response_message;
-	SoupHTTPVersion http_version;
-	guint response_status;
-	g_autoptr(GUri) uri = NULL;
+	UhmServerPrivate *priv = self->priv;
 
-	g_return_val_if_fail (trace != NULL, NULL);
+	g_assert (priv->next_message != NULL);
+	*message_counter = ++priv->message_counter;
 
-	/* The traces look somewhat like this:
-	 * > POST /unauth HTTP/1.1
-	 * > Soup-Debug-Timestamp: 1200171744
-	 * > Soup-Debug: SoupSessionAsync 1 (0x612190), SoupMessage 1 (0x617000), SoupSocket 1 (0x612220)
-	 * > Host: localhost
-	 * > Content-Type: text/plain
-	 * > Connection: close
-	 * > 
-	 * > This is a test.
-	 *   
-	 * < HTTP/1.1 201 Created
-	 * < Soup-Debug-Timestamp: 1200171744
-	 * < Soup-Debug: SoupMessage 1 (0x617000)
-	 * < Date: Sun, 12 Jan 2008 21:02:24 GMT
-	 * < Content-Length: 0
-	 *
-	 * This function parses a single request–response pair.
-	 */
+	if (compare_incoming_message (self, priv->next_message, message) != 0) {
+		gchar *body, *next_uri, *actual_uri;
 
-	/* Parse the method, URI and HTTP version first. */
-	if (*trace != '>' || *(trace + 1) != ' ') {
-		g_warning ("Unrecognised start sequence ‘%c%c’.", *trace, *(trace + 1));
-		goto error;
-	}
-	trace += 2;
+		/* Received message is not what we expected. Return an error. */
+		uhm_message_set_status (message, SOUP_STATUS_BAD_REQUEST,
+		                        "Unexpected request to mock server");
 
-	/* Parse “POST /unauth HTTP/1.1”. */
-	if (strncmp (trace, "POST", strlen ("POST")) == 0) {
-		method = SOUP_METHOD_POST;
-		trace += strlen ("POST");
-	} else if (strncmp (trace, "GET", strlen ("GET")) == 0) {
-		method = SOUP_METHOD_GET;
-		trace += strlen ("GET");
-	} else if (strncmp (trace, "DELETE", strlen ("DELETE")) == 0) {
-		method = SOUP_METHOD_DELETE;
-		trace += strlen ("DELETE");
-	} else if (strncmp (trace, "PUT", strlen ("PUT")) == 0) {
-		method = SOUP_METHOD_PUT;
-		trace += strlen ("PUT");
-	} else if (strncmp (trace, "PATCH", strlen ("PATCH")) == 0) {
-		method = "PATCH";
-		trace += strlen ("PATCH");
-	} else if (strncmp (trace, "CONNECT", strlen ("CONNECT")) == 0) {
-		method = "CONNECT";
-		trace += strlen ("CONNECT");
-	} else {
-		g_warning ("Unknown method ‘%s’.", trace);
-		goto error;
-	}
+		next_uri = uri_get_path_query (uhm_message_get_uri (priv->next_message));
+		actual_uri = uri_get_path_query (uhm_message_get_uri (message));
+		body = g_strdup_printf ("Expected %s URI ‘%s’, but got %s ‘%s’.",
+		                        uhm_message_get_method (priv->next_message),
+		                        next_uri, uhm_message_get_method (message), actual_uri);
+		g_free (actual_uri);
+		g_free (next_uri);
+		soup_message_body_append_take (uhm_message_get_response_body (message), (guchar *) body, strlen (body) + 1);
 
-	if (*trace != ' ') {
-		g_warning ("Unrecognised spacer ‘%c’.", *trace);
-		goto error;
-	}
-	trace++;
+		server_response_append_headers (self, message, *message_counter);
 
-	i = strchr (trace, ' ');
-	if (i == NULL) {
-		g_warning ("Missing spacer ‘ ’.");
-		goto error;
+		return NULL;
 	}
 
-	uri_string = g_strndup (trace, i - trace);
-	trace += (i - trace) + 1;
+	/* The incoming message matches what we expected, so the headers and body of the expected response should be returned. */
+	return g_steal_pointer (&priv->next_message);
+}
 
-	if (strncmp (trace, "HTTP/1.1", strlen ("HTTP/1.1")) == 0) {
-		http_version = SOUP_HTTP_1_1;
-		trace += strlen ("HTTP/1.1");
-	} else if (strncmp (trace, "HTTP/1.0", strlen ("HTTP/1.0")) == 0) {
-		http_version = SOUP_HTTP_1_0;
-		trace += strlen ("HTTP/1.0");
-	} else if (strncmp (trace, "HTTP/2", strlen ("HTTP/2")) == 0) {
-		http_version = SOUP_HTTP_2_0;
-		trace += strlen ("HTTP/2");
-	} else {
-		g_warning ("Unrecognised HTTP version ‘%s’.", trace);
-		http_version = SOUP_HTTP_1_1;
-	}
+/* Builds the key used to look up messages in the unordered matching index. This is the method, path and query of the request, which the
+ * default UhmServer::compare-messages handler compares exactly. */
+static gchar *
+build_request_key (UhmMessage *message)
+{
+	GUri *uri = uhm_message_get_uri (message);
+	const gchar *query = g_uri_get_query (uri);
 
-	if (*trace != '\n') {
-		g_warning ("Unrecognised spacer ‘%c’.", *trace);
-		goto error;
+	if (query == NULL) {
+		return g_strdup_printf ("%s %s", uhm_message_get_method (message), g_uri_get_path (uri));
 	}
-	trace++;
 
-	/* Build the message. */
-	uri = g_uri_parse_relative (base_uri, uri_string, SOUP_HTTP_URI_FLAGS, NULL);
-	message = uhm_message_new_from_uri (method, uri);
+	return g_strdup_printf ("%s %s?%s", uhm_message_get_method (message), g_uri_get_path (uri), query);
+}
 
-	if (message == NULL) {
-		g_warning ("Invalid URI ‘%s’.", uri_string);
-		goto error;
-	}
+/* Builds an unordered matching index of the remaining preloaded messages, transferring them out of priv->preloaded_messages. */
+static void
+build_unordered_index (UhmServer *self)
+{
+	UhmServerPrivate *priv = self->priv;
+	guint i;
 
-	uhm_message_set_http_version (message, http_version);
-	g_free (uri_string);
+	priv->unordered_messages = g_queue_new ();
+	priv->unordered_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_queue_free);
 
-	/* Parse the request headers and body. */
-	if (trace_to_soup_message_headers_and_body (uhm_message_get_request_headers (message), uhm_message_get_request_body (message), '>', &trace) == FALSE) {
-		goto error;
-	}
+	for (i = priv->preloaded_index; i < priv->preloaded_messages->len; i++) {
+		UhmMessage *message = g_ptr_array_index (priv->preloaded_messages, i);
+		gchar *key;
+		GQueue *queue;
 
-	/* Parse the response, starting with “HTTP/1.1 201 Created”. */
-	if (*trace != '<' || *(trace + 1) != ' ') {
-		g_warning ("Unrecognised start sequence ‘%c%c’.", *trace, *(trace + 1));
-		goto error;
-	}
-	trace += 2;
+		key = build_request_key (message);
+		queue = g_hash_table_lookup (priv->unordered_index, key);
 
-	if (strncmp (trace, "HTTP/1.1", strlen ("HTTP/1.1")) == 0) {
-		http_version = SOUP_HTTP_1_1;
-		trace += strlen ("HTTP/1.1");
-	} else if (strncmp (trace, "HTTP/1.0", strlen ("HTTP/1.0")) == 0) {
-		http_version = SOUP_HTTP_1_0;
-		trace += strlen ("HTTP/1.0");
-	} else if (strncmp (trace, "HTTP/2", strlen ("HTTP/2")) == 0) {
-		http_version = SOUP_HTTP_2_0;
-		trace += strlen ("HTTP/2");
-	} else {
-		g_warning ("Unrecognised HTTP version ‘%s’.", trace);
-	}
+		if (queue == NULL) {
+			queue = g_queue_new ();
+			g_hash_table_insert (priv->unordered_index, key, queue);
+		} else {
+			g_free (key);
+		}
 
-	if (*trace != ' ') {
-		g_warning ("Unrecognised spacer ‘%c’.", *trace);
-		goto error;
+		g_queue_push_tail (priv->unordered_messages, g_object_ref (message));
+		g_queue_push_tail (queue, priv->unordered_messages->tail);
 	}
-	trace++;
+}
 
-	i = strchr (trace, ' ');
-	if (i == NULL) {
-		g_warning ("Missing spacer ‘ ’.");
-		goto error;
-	}
+/* Removes the message at @link in priv->unordered_messages, which is at @queue_link in its index queue @queue, and returns it. */
+static UhmMessage *
+unordered_messages_take (UhmServerPrivate *priv, GList *link, GQueue *queue, GList *queue_link)
+{
+	UhmMessage *expected_message = link->data;
 
-	response_status = g_ascii_strtoull (trace, (gchar **) &j, 10);
-	if (j != i) {
-		g_warning ("Invalid status ‘%s’.", trace);
-		goto error;
-	}
-	trace += (i - trace) + 1;
+	g_queue_delete_link (queue, queue_link);
+	g_queue_delete_link (priv->unordered_messages, link);
 
-	i = strchr (trace, '\n');
-	if (i == NULL) {
-		g_warning ("Missing spacer ‘\n’.");
-		goto error;
-	}
+	return expected_message;
+}
 
-	response_message = g_strndup (trace, i - trace);
-	trace += (i - trace) + 1;
+/* Finds, removes and returns the first unconsumed message from the trace which matches @message, or returns %NULL if there is none. */
+static UhmMessage *
+take_unordered_message (UhmServer *self, UhmMessage *message)
+{
+	UhmServerPrivate *priv = self->priv;
+	g_autofree gchar *key = NULL;
+	GQueue *queue;
+	GList *l;
 
-	uhm_message_set_status (message, response_status, response_message);
+	key = build_request_key (message);
+	queue = g_hash_table_lookup (priv->unordered_index, key);
 
-	g_free (response_message);
+	for (l = (queue != NULL) ? queue->head : NULL; l != NULL; l = l->next) {
+		GList *link = l->data;
 
-	/* Parse the response headers and body. */
-	if (trace_to_soup_message_headers_and_body (uhm_message_get_response_headers (message), uhm_message_get_response_body (message), '<', &trace) == FALSE) {
-		goto error;
+		if (compare_incoming_message (self, link->data, message) == 0) {
+			return unordered_messages_take (priv, link, queue, l);
+		}
 	}
 
-	return message;
+	/* Fall back to trying every unconsumed message, in trace order, in case a compare-messages handler accepts requests which differ from
+	 * those in the trace (for example, by ignoring parameter values). Only the matching message's key needs building. */
+	for (l = priv->unordered_messages->head; l != NULL; l = l->next) {
+		UhmMessage *expected_message = l->data;
 
-error:
-	g_clear_object (&message);
+		if (compare_incoming_message (self, expected_message, message) == 0) {
+			g_free (key);
+			key = build_request_key (expected_message);
+			queue = g_hash_table_lookup (priv->unordered_index, key);
+			g_assert (queue != NULL);
+
+			return unordered_messages_take (priv, l, queue, g_queue_find (queue, l));
+		}
+	}
 
 	return NULL;
 }
 
-static GDataInputStream *
-load_file_stream (GFile *trace_file, GCancellable *cancellable, GError **error)
+/* As server_take_next_message(), but matches @message against all the unconsumed messages in the trace. Must be called with the trace lock
+ * held. */
+static UhmMessage *
+server_take_unordered_message (UhmServer *self, UhmMessage *message, guint *message_counter)
 {
-	GFileInputStream *base_stream = NULL;  /* owned */
-	GDataInputStream *data_stream = NULL;  /* owned */
+	UhmServerPrivate *priv = self->priv;
+	UhmMessage *expected_message;
 
-	base_stream = g_file_read (trace_file, cancellable, error);
+	*message_counter = ++priv->message_counter;
+	expected_message = take_unordered_message (self, message);
 
-	if (base_stream == NULL)
-		return NULL;
+	if (expected_message == NULL) {
+		gchar *body, *actual_uri;
 
-	data_stream = g_data_input_stream_new (G_INPUT_STREAM (base_stream));
-	g_data_input_stream_set_byte_order (data_stream, G_DATA_STREAM_BYTE_ORDER_LITTLE_ENDIAN);
-	g_data_input_stream_set_newline_type (data_stream, G_DATA_STREAM_NEWLINE_TYPE_LF);
+		/* Received message is not in the trace, or has already been consumed. Return an error. */
+		uhm_message_set_status (message, SOUP_STATUS_BAD_REQUEST,
+		                        "Unexpected request to mock server");
 
-	g_object_unref (base_stream);
+		actual_uri = uri_get_path_query (uhm_message_get_uri (message));
+		body = g_strdup_printf ("Expected no more requests matching %s ‘%s’, but got one.", uhm_message_get_method (message), actual_uri);
+		g_free (actual_uri);
+		soup_message_body_append_take (uhm_message_get_response_body (message), (guchar *) body, strlen (body) + 1);
 
-	return data_stream;
+		server_response_append_headers (self, message, *message_counter);
+	}
+
+	return expected_message;
 }
 
-static gboolean
-load_message_half (GDataInputStream *input_stream, GString *current_message, GCancellable *cancellable, GError **error)
+static void
+server_wrote_body_data_cb (SoupServerMessage *message, guint chunk_size, gpointer user_data)
 {
-	gsize len;
-	gchar *line = NULL;  /* owned */
-	GError *child_error = NULL;
+	UhmServer *self = user_data;
 
-	while (TRUE) {
-		line = g_data_input_stream_read_line (input_stream, &len, cancellable, &child_error);
+	g_mutex_lock (&self->priv->statistics_lock);
+	self->priv->bytes_written += chunk_size;
+	g_mutex_unlock (&self->priv->statistics_lock);
+}
 
-		if (line == NULL && child_error != NULL) {
-			/* Error. */
-			g_propagate_error (error, child_error);
-			return FALSE;
-		} else if (line == NULL) {
-			/* EOF. Try again to grab a response. */
-			return TRUE;
-		} else {
-			gboolean reached_eom;
+static void
+server_handler_cb (SoupServer *server, SoupServerMessage *message, const gchar *path, GHashTable *query, gpointer user_data)
+{
+	UhmServer *self = user_data;
+	UhmMessage *umsg;
+	gboolean message_handled = FALSE;
 
-			reached_eom = (g_strcmp0 (line, "  ") == 0);
+	/* The SoupServer, and hence the message, doesn't outlive self. */
+	g_signal_connect (message, "wrote-body-data", (GCallback) server_wrote_body_data_cb, self);
 
-			g_string_append_len (current_message, line, len);
-			g_string_append_c (current_message, '\n');
+	soup_server_message_pause (message);
+	umsg = uhm_message_new_from_server_message (message);
 
-			g_free (line);
+	g_signal_emit (self, signals[SIGNAL_HANDLE_MESSAGE], 0, umsg, &message_handled);
 
-			if (reached_eom) {
-				/* Reached the end of the message. */
-				return TRUE;
-			}
-		}
-	}
+	soup_server_message_set_http_version (message, uhm_message_get_http_version (umsg));
+	soup_server_message_set_status (message, uhm_message_get_status (umsg), uhm_message_get_reason_phrase (umsg));
+
+	g_object_unref (umsg);
+	soup_server_message_unpause (message);
+
+	/* The message should always be handled by real_handle_message() at least. */
+	g_assert (message_handled == TRUE);
 }
 
-static UhmMessage *
-load_file_iteration (GDataInputStream *input_stream, GUri *base_uri, GCancellable *cancellable, GError **error)
+/* Number of messages the trace reader thread loads ahead of the one which is currently expected. */
+#define TRACE_READER_LOOKAHEAD 8
+
+/* A thread which loads the messages from a trace which wasn't preloaded ahead of them being needed, so requests don't have to wait for the
+ * trace to be read and parsed. The thread is the only producer for the bounded queue of loaded messages, and load_next_message() (called
+ * with the trace lock held) is the only consumer. While the thread is running, it owns the trace loading state in UhmServerPrivate
+ * (input_stream, trace_offset, etc.). */
+struct _TraceReader {
+	UhmServer *server;  /* unowned; outlives the reader */
+	GUri *base_uri;  /* owned; nullable */
+	guint port;  /* port the server was listening on when the reader was started */
+	GThread *thread;  /* owned */
+	GCancellable *cancellable;  /* owned */
+
+	/* The lock protects everything below. The condition is signalled when a message is added to or removed from the queue, or the reader is
+	 * stopped. As the queue has a single producer and a single consumer, at most one of them is waiting on it at once. */
+	GMutex lock;
+	GCond cond;
+	UhmMessage *queue[TRACE_READER_LOOKAHEAD];  /* owned; ring buffer */
+	guint queue_head;
+	guint queue_length;
+	gboolean finished;  /* whether the end of the trace, or an error, has been reached */
+	GError *error;  /* owned; nullable */
+	gboolean stopping;
+};
+
+static gpointer
+trace_reader_thread_cb (gpointer user_data)
 {
-	UhmMessage *output_message = NULL;
-	GString *current_message = NULL;
+	TraceReader *reader = user_data;
+	UhmServer *self = reader->server;
+	UhmServerPrivate *priv = self->priv;
 
-	current_message = g_string_new (NULL);
+	while (TRUE) {
+		UhmMessage *message;
+		GError *child_error = NULL;
 
-	do {
-		/* Start loading from the stream. */
-		g_string_truncate (current_message, 0);
+		if (priv->trace_bytes != NULL) {
+			message = load_mapped_message (self, reader->base_uri);
+		} else {
+			message = load_file_iteration (priv->input_stream, reader->base_uri, reader->cancellable, &child_error);
+		}
 
-		/* We should be at the start of a request; grab it. */
-		if (!load_message_half (input_stream, current_message, cancellable, error) ||
-		    !load_message_half (input_stream, current_message, cancellable, error)) {
-			goto done;
+		statistics_update_trace_bytes_read (self);
+
+		if (message != NULL) {
+			bind_trace_message (self, message, reader->port);
 		}
 
-		if (current_message->len > 0) {
-			output_message = trace_to_soup_message (current_message->str, base_uri);
+		g_mutex_lock (&reader->lock);
+
+		while (reader->queue_length == TRACE_READER_LOOKAHEAD && reader->stopping == FALSE) {
+			g_cond_wait (&reader->cond, &reader->lock);
+		}
+
+		if (reader->stopping == TRUE) {
+			g_mutex_unlock (&reader->lock);
+
+			g_clear_object (&message);
+			g_clear_error (&child_error);
+
+			break;
+		} else if (message == NULL) {
+			/* Reached the end of the trace, or an error. */
+			reader->finished = TRUE;
+			reader->error = child_error;
+			g_cond_signal (&reader->cond);
+			g_mutex_unlock (&reader->lock);
+
+			break;
+		}
+
+		reader->queue[(reader->queue_head + reader->queue_length) % TRACE_READER_LOOKAHEAD] = message;
+		reader->queue_length++;
+		g_cond_signal (&reader->cond);
+
+		g_mutex_unlock (&reader->lock);
+	}
+
+	return NULL;
+}
+
+/* Starts a reader thread which loads the remaining messages from the current trace, resolving their URIs relative to @base_uri. */
+static TraceReader *
+trace_reader_new (UhmServer *self, GUri *base_uri)
+{
+	TraceReader *reader;
+
+	reader = g_slice_new0 (TraceReader);
+	reader->server = self;
+	reader->base_uri = (base_uri != NULL) ? g_uri_ref (base_uri) : NULL;
+	reader->port = self->priv->port;
+	reader->cancellable = g_cancellable_new ();
+	g_mutex_init (&reader->lock);
+	g_cond_init (&reader->cond);
+
+	reader->thread = g_thread_new ("uhm-trace-reader", trace_reader_thread_cb, reader);
+
+	return reader;
+}
+
+/* Stops the reader thread, and frees any messages it loaded which weren't taken. */
+static void
+trace_reader_free (TraceReader *reader)
+{
+	g_mutex_lock (&reader->lock);
+	reader->stopping = TRUE;
+	g_cond_broadcast (&reader->cond);
+	g_mutex_unlock (&reader->lock);
+
+	/* Interrupt any blocking read. */
+	g_cancellable_cancel (reader->cancellable);
+	g_thread_join (reader->thread);
+
+	while (reader->queue_length > 0) {
+		g_object_unref (reader->queue[reader->queue_head]);
+		reader->queue_head = (reader->queue_head + 1) % TRACE_READER_LOOKAHEAD;
+		reader->queue_length--;
+	}
+
+	g_clear_error (&reader->error);
+	g_clear_pointer (&reader->base_uri, g_uri_unref);
+	g_clear_object (&reader->cancellable);
+	g_mutex_clear (&reader->lock);
+	g_cond_clear (&reader->cond);
+
+	g_slice_free (TraceReader, reader);
+}
+
+/* Takes the next message loaded by the reader thread, waiting for it to be loaded if necessary. Returns %NULL if the end of the trace has
+ * been reached, or on error. */
+static UhmMessage *
+trace_reader_take_message (TraceReader *reader, GError **error)
+{
+	UhmMessage *message = NULL;
+
+	g_mutex_lock (&reader->lock);
+
+	while (reader->queue_length == 0 && reader->finished == FALSE) {
+		g_cond_wait (&reader->cond, &reader->lock);
+	}
+
+	if (reader->queue_length > 0) {
+		message = reader->queue[reader->queue_head];
+		reader->queue[reader->queue_head] = NULL;
+		reader->queue_head = (reader->queue_head + 1) % TRACE_READER_LOOKAHEAD;
+		reader->queue_length--;
+		g_cond_signal (&reader->cond);
+	} else if (reader->error != NULL) {
+		g_propagate_error (error, g_error_copy (reader->error));
+	}
+
+	g_mutex_unlock (&reader->lock);
+
+	return message;
+}
+
+/* Returns the next message from the current trace, or %NULL if the end of the trace has been reached. If the trace was preloaded, this is
+ * an array lookup; otherwise the message is taken from the trace reader thread, which should already have loaded it. */
+static UhmMessage *
+load_next_message (UhmServer *self, GError **error)
+{
+	UhmServerPrivate *priv = self->priv;
+
+	if (priv->preloaded_messages != NULL) {
+		if (priv->preloaded_index >= priv->preloaded_messages->len) {
+			return NULL;
+		}
+
+		return g_object_ref (g_ptr_array_index (priv->preloaded_messages, priv->preloaded_index++));
+	}
+
+	if (priv->trace_reader == NULL) {
+		/* The trace was empty, or no trace is loaded. */
+		return NULL;
+	}
+
+	return trace_reader_take_message (priv->trace_reader, error);
+}
+
+static gboolean
+real_handle_message (UhmServer *self, UhmMessage *message)
+{
+	UhmServerPrivate *priv = self->priv;
+	UhmMessage *expected_message = NULL;  /* owned */
+	guint message_counter = 0;
+
+	/* The trace may be shared between several worker threads, so only one of them may access it at a time. The response is copied out of
+	 * the expected message without the lock held. */
+	g_mutex_lock (&priv->trace_lock);
+
+	if (priv->unordered_index != NULL) {
+		/* Match the message against the whole trace if doing unordered matching. */
+		expected_message = server_take_unordered_message (self, message, &message_counter);
+	} else if (priv->next_message == NULL) {
+		GError *child_error = NULL;
+		gint64 start_time;
+
+		/* Load the next expected message from the trace file. */
+		start_time = g_get_monotonic_time ();
+		priv->next_message = load_next_message (self, &child_error);
+		statistics_add_time (self, &priv->trace_fetch_time, start_time);
+
+		if (child_error != NULL) {
+			gchar *body;
+
+			uhm_message_set_status (message, SOUP_STATUS_INTERNAL_SERVER_ERROR,
+			                        "Error loading expected request");
+
+			body = g_strdup_printf ("Error: %s", child_error->message);
+			soup_message_body_append_take (uhm_message_get_response_body (message), (guchar *) body, strlen (body) + 1);
+
+			g_error_free (child_error);
+
+			server_response_append_headers (self, message, priv->message_counter);
+		} else if (priv->next_message == NULL) {
+			gchar *body, *actual_uri;
+
+			/* Received message is not what we expected. Return an error. */
+			uhm_message_set_status (message, SOUP_STATUS_BAD_REQUEST,
+			                        "Unexpected request to mock server");
+
+			actual_uri = uri_get_path_query (uhm_message_get_uri (message));
+			body = g_strdup_printf ("Expected no request, but got %s ‘%s’.", uhm_message_get_method (message), actual_uri);
+			g_free (actual_uri);
+			soup_message_body_append_take (uhm_message_get_response_body (message), (guchar *) body, strlen (body) + 1);
+
+			server_response_append_headers (self, message, priv->message_counter);
+		}
+	}
+
+	/* Process the actual message if we already know the expected message. */
+	if (priv->unordered_index == NULL && priv->next_message != NULL) {
+		expected_message = server_take_next_message (self, message, &message_counter);
+	}
+
+	g_mutex_unlock (&priv->trace_lock);
+
+	g_mutex_lock (&priv->statistics_lock);
+	priv->requests_handled++;
+	if (expected_message == NULL) {
+		priv->mismatches++;
+	}
+	g_mutex_unlock (&priv->statistics_lock);
+
+	if (expected_message != NULL) {
+		server_respond_from_trace (self, message, expected_message, message_counter);
+		g_object_unref (expected_message);
+	}
+
+	return TRUE;
+}
+
+/* Prepares to replay a preloaded trace: either indexes it for unordered matching, or takes its first message as the next expected message.
+ * Traces are always replayed in order when they're being compared against online traffic. */
+static void
+start_preloaded_replay (UhmServer *self)
+{
+	UhmServerPrivate *priv = self->priv;
+
+	if (priv->enable_unordered_matching == TRUE && (priv->enable_online == FALSE || priv->enable_logging == TRUE)) {
+		build_unordered_index (self);
+	} else {
+		priv->next_message = load_next_message (self, NULL);
+	}
+}
+
+/**
+ * uhm_server_new:
+ *
+ * Creates a new #UhmServer with default properties.
+ *
+ * Return value: (transfer full): a new #UhmServer; unref with g_object_unref()
+ *
+ * Since: 0.1.0
+ */
+UhmServer *
+uhm_server_new (void)
+{
+	return g_object_new (UHM_TYPE_SERVER, NULL);
+}
+
+/* Returns the character at offset @n from @trace, or a nul byte if that is beyond @trace_end. Traces are not necessarily nul-terminated
+ * (for example, if they are memory mapped), so all look-ahead must be bounded. */
+static inline gchar
+trace_char_at (const gchar *trace, const gchar *trace_end, gsize n)
+{
+	return ((gsize) (trace_end - trace) > n) ? trace[n] : '\0';
+}
+
+static inline gboolean
+trace_has_prefix (const gchar *trace, const gchar *trace_end, const gchar *prefix)
+{
+	gsize prefix_length = strlen (prefix);
+
+	return ((gsize) (trace_end - trace) >= prefix_length && memcmp (trace, prefix, prefix_length) == 0);
+}
+
+/* Length of the line starting at @trace, excluding the newline. Used for formatting warnings. */
+static inline int
+trace_line_length (const gchar *trace, const gchar *trace_end)
+{
+	const gchar *i = memchr (trace, '\n', trace_end - trace);
+
+	return (i != NULL) ? i - trace : trace_end - trace;
+}
+
+/* Whether @trace points to a “  ” line, which terminates each half of a message. */
+static inline gboolean
+trace_is_terminator (const gchar *trace, const gchar *trace_end)
+{
+	return (trace_char_at (trace, trace_end, 0) == ' ' && trace_char_at (trace, trace_end, 1) == ' ' &&
+	        (trace_char_at (trace, trace_end, 2) == '\n' || trace + 2 == trace_end));
+}
+
+/* Bitmap of the characters allowed in tokens, such as HTTP methods (RFC 7230, §3.2.6): alphanumerics and !#$%&'*+-.^_`|~. */
+static const guint32 token_chars[256 / 32] = {
+	0x00000000, 0x03ff6cfa, 0xc7fffffe, 0x57ffffff, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+};
+
+static inline gboolean
+trace_is_token_char (gchar c)
+{
+	return (token_chars[(guint8) c / 32] >> ((guint8) c % 32)) & 1;
+}
+
+/* Common HTTP methods, so that parsing them doesn't need an allocation. */
+static const gchar * const known_methods[] = {
+	"GET", "POST", "PUT", "DELETE", "HEAD", "OPTIONS", "PATCH", "CONNECT", "TRACE",
+	"PROPFIND", "PROPPATCH", "MKCOL", "COPY", "MOVE", "LOCK", "UNLOCK",
+};
+
+/* Returns the static string for the method @token of length @length from known_methods, or %NULL if it's not a known method. */
+static const gchar *
+trace_intern_known_method (const gchar *token, gsize length)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (known_methods); i++) {
+		if (strncmp (known_methods[i], token, length) == 0 && known_methods[i][length] == '\0') {
+			return known_methods[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Copies the @length bytes at @data into @scratch, which is reused for each string parsed from a message, and returns them as a
+ * nul-terminated string. This avoids allocating each string separately just to nul-terminate it. */
+static const gchar *
+trace_scratch_string (GString *scratch, const gchar *data, gsize length)
+{
+	g_string_truncate (scratch, 0);
+	g_string_append_len (scratch, data, length);
+
+	return scratch->str;
+}
+
+/* Appends @length bytes from @data to @message_body. If @trace_bytes is non-%NULL, @data must point inside it, and the chunk will reference
+ * @trace_bytes rather than copying the data. */
+static void
+message_body_append_trace (SoupMessageBody *message_body, GBytes *trace_bytes, const gchar *data, gsize length)
+{
+	if (length == 0) {
+		return;
+	}
+
+	if (trace_bytes != NULL) {
+		g_autoptr(GBytes) chunk = NULL;
+		const gchar *trace_data = g_bytes_get_data (trace_bytes, NULL);
+
+		chunk = g_bytes_new_from_bytes (trace_bytes, data - trace_data, length);
+		soup_message_body_append_bytes (message_body, chunk);
+	} else {
+		soup_message_body_append (message_body, SOUP_MEMORY_COPY, data, length);
+	}
+}
+
+static gboolean
+trace_to_soup_message_headers_and_body (SoupMessageHeaders *message_headers, SoupMessageBody *message_body, const gchar message_direction,
+                                        const gchar **_trace, const gchar *trace_end, GBytes *trace_bytes, GString *scratch)
+{
+	const gchar *i;
+	const gchar *trace = *_trace;
+
+	/* Parse headers. */
+	while (TRUE) {
+		gsize header_name_length;
+
+		if (trace >= trace_end) {
+			/* No body. */
+			goto done;
+		} else if (trace_is_terminator (trace, trace_end)) {
+			/* No body. */
+			trace = MIN (trace + 3, trace_end);
+			goto done;
+		} else if (*trace != message_direction || trace_char_at (trace, trace_end, 1) != ' ') {
+			g_warning ("Unrecognised start sequence ‘%c%c’.", *trace, trace_char_at (trace, trace_end, 1));
+			goto error;
+		}
+		trace += 2;
+
+		if (trace_char_at (trace, trace_end, 0) == '\n') {
+			/* Reached the end of the headers. */
+			trace++;
+			break;
+		}
+
+		i = memchr (trace, ':', trace_end - trace);
+		if (i == NULL || trace_char_at (i, trace_end, 1) != ' ') {
+			g_warning ("Missing spacer ‘: ’.");
+			goto error;
+		}
+
+		/* Copy the name and value into the scratch buffer, one after the other, to nul-terminate them; libsoup copies them again. */
+		header_name_length = i - trace;
+		trace_scratch_string (scratch, trace, header_name_length);
+		g_string_append_c (scratch, '\0');
+		trace += header_name_length + 2;
+
+		i = memchr (trace, '\n', trace_end - trace);
+		if (i == NULL) {
+			g_warning ("Missing spacer ‘\\n’.");
+			goto error;
+		}
+
+		g_string_append_len (scratch, trace, i - trace);
+		trace += (i - trace) + 1;
+
+		/* Append the header. */
+		soup_message_headers_append (message_headers, scratch->str, scratch->str + header_name_length + 1);
+	}
+
+	/* Parse the body. */
+	while (TRUE) {
+		if (trace_is_terminator (trace, trace_end)) {
+			/* End of the body. */
+			trace = MIN (trace + 3, trace_end);
+			break;
+		} else if (trace >= trace_end) {
+			/* End of the body. */
+			break;
+		} else if (*trace != message_direction || trace_char_at (trace, trace_end, 1) != ' ') {
+			g_warning ("Unrecognised start sequence ‘%c%c’.", *trace, trace_char_at (trace, trace_end, 1));
+			goto error;
+		}
+		trace += 2;
+
+		/* The final line of a mapped trace file may not have a trailing newline. */
+		i = memchr (trace, '\n', trace_end - trace);
+		i = (i != NULL) ? i + 1 : trace_end;  /* include trailing \n */
+
+		message_body_append_trace (message_body, trace_bytes, trace, i - trace);
+		trace = i;
+	}
+
+done:
+	/* Done. Update the output trace pointer. */
+	soup_message_body_complete (message_body);
+	*_trace = trace;
+
+	return TRUE;
+
+error:
+	return FALSE;
+}
+
+/* base_uri is the base URI for the server, e.g. https://127.0.0.1:1431.
+ * trace_bytes is optional; if it is non-%NULL, trace must point inside it, and the message bodies will reference trace_bytes rather than
+ * copying from trace. */
+static UhmMessage *
+trace_to_soup_message (const gchar *trace, gsize trace_length, GBytes *trace_bytes, GUri *base_uri)
+{
+	UhmMessage *message = NULL;
+	const gchar *i, *j, *method, *trace_end;
+	gchar *unknown_method = NULL;
+	SoupHTTPVersion http_version;
+	guint response_status;
+	g_autoptr(GUri) uri = NULL;
+	g_autoptr(GString) scratch = NULL;
+
+	g_return_val_if_fail (trace != NULL, NULL);
+
+	scratch = g_string_sized_new (256);
+
+	trace_end = trace + trace_length;
+
+	/* The traces look somewhat like this:
+	 * > POST /unauth HTTP/1.1
+	 * > Soup-Debug-Timestamp: 1200171744
+	 * > Soup-Debug: SoupSessionAsync 1 (0x612190), SoupMessage 1 (0x617000), SoupSocket 1 (0x612220)
+	 * > Host: localhost
+	 * > Content-Type: text/plain
+	 * > Connection: close
+	 * > 
+	 * > This is a test.
+	 *   
+	 * < HTTP/1.1 201 Created
+	 * < Soup-Debug-Timestamp: 1200171744
+	 * < Soup-Debug: SoupMessage 1 (0x617000)
+	 * < Date: Sun, 12 Jan 2008 21:02:24 GMT
+	 * < Content-Length: 0
+	 *
+	 * This function parses a single request–response pair.
+	 */
+
+	/* Parse the method, URI and HTTP version first. */
+	if (trace_char_at (trace, trace_end, 0) != '>' || trace_char_at (trace, trace_end, 1) != ' ') {
+		g_warning ("Unrecognised start sequence ‘%c%c’.", trace_char_at (trace, trace_end, 0), trace_char_at (trace, trace_end, 1));
+		goto error;
+	}
+	trace += 2;
+
+	/* Parse “POST /unauth HTTP/1.1”. The method can be any token. */
+	i = trace;
+	while (i < trace_end && trace_is_token_char (*i)) {
+		i++;
+	}
+
+	if (i == trace) {
+		g_warning ("Unknown method ‘%.*s’.", trace_line_length (trace, trace_end), trace);
+		goto error;
+	}
+
+	method = trace_intern_known_method (trace, i - trace);
+	if (method == NULL) {
+		method = unknown_method = g_strndup (trace, i - trace);
+	}
+	trace = i;
+
+	if (trace_char_at (trace, trace_end, 0) != ' ') {
+		g_warning ("Unrecognised spacer ‘%c’.", trace_char_at (trace, trace_end, 0));
+		goto error;
+	}
+	trace++;
+
+	i = memchr (trace, ' ', trace_end - trace);
+	if (i == NULL) {
+		g_warning ("Missing spacer ‘ ’.");
+		goto error;
+	}
+
+	trace_scratch_string (scratch, trace, i - trace);
+	trace += (i - trace) + 1;
+
+	if (trace_has_prefix (trace, trace_end, "HTTP/1.1")) {
+		http_version = SOUP_HTTP_1_1;
+		trace += strlen ("HTTP/1.1");
+	} else if (trace_has_prefix (trace, trace_end, "HTTP/1.0")) {
+		http_version = SOUP_HTTP_1_0;
+		trace += strlen ("HTTP/1.0");
+	} else if (trace_has_prefix (trace, trace_end, "HTTP/2")) {
+		http_version = SOUP_HTTP_2_0;
+		trace += strlen ("HTTP/2");
+	} else {
+		g_warning ("Unrecognised HTTP version ‘%.*s’.", trace_line_length (trace, trace_end), trace);
+		http_version = SOUP_HTTP_1_1;
+	}
+
+	if (trace_char_at (trace, trace_end, 0) != '\n') {
+		g_warning ("Unrecognised spacer ‘%c’.", trace_char_at (trace, trace_end, 0));
+		goto error;
+	}
+	trace++;
+
+	/* Build the message. The URI is in the scratch buffer. */
+	uri = g_uri_parse_relative (base_uri, scratch->str, SOUP_HTTP_URI_FLAGS, NULL);
+
+	if (uri == NULL) {
+		goto error;
+	}
+
+	message = uhm_message_new_from_uri (method, uri);
+
+	if (message == NULL) {
+		g_warning ("Invalid URI ‘%s’.", scratch->str);
+		goto error;
+	}
+
+	uhm_message_set_http_version (message, http_version);
+	g_clear_pointer (&unknown_method, g_free);
+
+	/* Parse the request headers and body. */
+	if (trace_to_soup_message_headers_and_body (uhm_message_get_request_headers (message), uhm_message_get_request_body (message), '>',
+	                                            &trace, trace_end, trace_bytes, scratch) == FALSE) {
+		goto error;
+	}
+
+	/* Parse the response, starting with “HTTP/1.1 201 Created”. */
+	if (trace_char_at (trace, trace_end, 0) != '<' || trace_char_at (trace, trace_end, 1) != ' ') {
+		g_warning ("Unrecognised start sequence ‘%c%c’.", trace_char_at (trace, trace_end, 0), trace_char_at (trace, trace_end, 1));
+		goto error;
+	}
+	trace += 2;
+
+	if (trace_has_prefix (trace, trace_end, "HTTP/1.1")) {
+		http_version = SOUP_HTTP_1_1;
+		trace += strlen ("HTTP/1.1");
+	} else if (trace_has_prefix (trace, trace_end, "HTTP/1.0")) {
+		http_version = SOUP_HTTP_1_0;
+		trace += strlen ("HTTP/1.0");
+	} else if (trace_has_prefix (trace, trace_end, "HTTP/2")) {
+		http_version = SOUP_HTTP_2_0;
+		trace += strlen ("HTTP/2");
+	} else {
+		g_warning ("Unrecognised HTTP version ‘%.*s’.", trace_line_length (trace, trace_end), trace);
+	}
+
+	if (trace_char_at (trace, trace_end, 0) != ' ') {
+		g_warning ("Unrecognised spacer ‘%c’.", trace_char_at (trace, trace_end, 0));
+		goto error;
+	}
+	trace++;
+
+	i = memchr (trace, ' ', trace_end - trace);
+	if (i == NULL) {
+		g_warning ("Missing spacer ‘ ’.");
+		goto error;
+	}
+
+	/* This can't run past trace_end, since there's a space at i. */
+	response_status = g_ascii_strtoull (trace, (gchar **) &j, 10);
+	if (j != i) {
+		g_warning ("Invalid status ‘%.*s’.", trace_line_length (trace, trace_end), trace);
+		goto error;
+	}
+	trace += (i - trace) + 1;
+
+	i = memchr (trace, '\n', trace_end - trace);
+	if (i == NULL) {
+		g_warning ("Missing spacer ‘\\n’.");
+		goto error;
+	}
+
+	uhm_message_set_status (message, response_status, trace_scratch_string (scratch, trace, i - trace));
+	trace += (i - trace) + 1;
+
+	/* Parse the response headers and body. */
+	if (trace_to_soup_message_headers_and_body (uhm_message_get_response_headers (message), uhm_message_get_response_body (message), '<',
+	                                            &trace, trace_end, trace_bytes, scratch) == FALSE) {
+		goto error;
+	}
+
+	return message;
+
+error:
+	g_free (unknown_method);
+	g_clear_object (&message);
+
+	return NULL;
+}
+
+/* Compression formats recognised for trace files. Compressed traces are detected by their magic bytes when loading, and by their file
+ * extension when logging. */
+typedef enum {
+	TRACE_COMPRESSION_NONE,
+	TRACE_COMPRESSION_GZIP,
+	TRACE_COMPRESSION_ZSTD,
+} TraceCompression;
+
+#define TRACE_COMPRESSION_MAGIC_LENGTH 4
+
+static TraceCompression
+trace_compression_from_magic (const guint8 *data, gsize length)
+{
+	if (length >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+		return TRACE_COMPRESSION_GZIP;
+	} else if (length >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd) {
+		return TRACE_COMPRESSION_ZSTD;
+	}
+
+	return TRACE_COMPRESSION_NONE;
+}
+
+static TraceCompression
+trace_compression_from_file_name (GFile *trace_file)
+{
+	g_autofree gchar *basename = g_file_get_basename (trace_file);
+
+	if (basename != NULL && g_str_has_suffix (basename, ".gz")) {
+		return TRACE_COMPRESSION_GZIP;
+	} else if (basename != NULL && g_str_has_suffix (basename, ".zst")) {
+		return TRACE_COMPRESSION_ZSTD;
+	}
+
+	return TRACE_COMPRESSION_NONE;
+}
+
+/* Returns a new #GConverter to compress or decompress trace data in the given @compression format, or %NULL with @error set if the format
+ * isn't supported. GIO has no Zstandard implementation, so only gzip is currently supported. */
+static GConverter *
+trace_compression_new_converter (TraceCompression compression, gboolean compress, GError **error)
+{
+	switch (compression) {
+		case TRACE_COMPRESSION_GZIP:
+			if (compress == TRUE) {
+				return G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+			} else {
+				return G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+			}
+		case TRACE_COMPRESSION_ZSTD:
+			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Zstandard-compressed trace files are not supported.");
+			return NULL;
+		case TRACE_COMPRESSION_NONE:
+		default:
+			g_assert_not_reached ();
+	}
+}
+
+static GDataInputStream *
+new_trace_data_input_stream (GInputStream *base_stream)
+{
+	GDataInputStream *data_stream;
+
+	data_stream = g_data_input_stream_new (base_stream);
+	g_data_input_stream_set_byte_order (data_stream, G_DATA_STREAM_BYTE_ORDER_LITTLE_ENDIAN);
+	g_data_input_stream_set_newline_type (data_stream, G_DATA_STREAM_NEWLINE_TYPE_LF);
+
+	return data_stream;
+}
+
+/* Opens @trace_file for reading line by line. If it's compressed, it's transparently decompressed as it's read. */
+static GDataInputStream *
+load_file_stream (GFile *trace_file, GCancellable *cancellable, GError **error)
+{
+	GFileInputStream *base_stream = NULL;  /* owned */
+	GDataInputStream *data_stream = NULL;  /* owned */
+	GConverter *decompressor = NULL;  /* owned */
+	GInputStream *decompressed_stream = NULL;  /* owned */
+	TraceCompression compression;
+	const guint8 *magic;
+	gsize magic_length;
+
+	base_stream = g_file_read (trace_file, cancellable, error);
+
+	if (base_stream == NULL)
+		return NULL;
+
+	data_stream = new_trace_data_input_stream (G_INPUT_STREAM (base_stream));
+	g_object_unref (base_stream);
+
+	/* Peek at the start of the file to see whether it's compressed. Short reads are possible, so keep filling until there's enough data to
+	 * check the magic bytes, or the end of the file is reached. */
+	magic_length = g_buffered_input_stream_get_available (G_BUFFERED_INPUT_STREAM (data_stream));
+
+	while (magic_length < TRACE_COMPRESSION_MAGIC_LENGTH) {
+		gssize n_read;
+
+		n_read = g_buffered_input_stream_fill (G_BUFFERED_INPUT_STREAM (data_stream), TRACE_COMPRESSION_MAGIC_LENGTH - magic_length,
+		                                       cancellable, error);
+
+		if (n_read < 0) {
+			g_object_unref (data_stream);
+			return NULL;
+		} else if (n_read == 0) {
+			break;
+		}
+
+		magic_length += n_read;
+	}
+
+	magic = g_buffered_input_stream_peek_buffer (G_BUFFERED_INPUT_STREAM (data_stream), &magic_length);
+	compression = trace_compression_from_magic (magic, magic_length);
+
+	if (compression == TRACE_COMPRESSION_NONE) {
+		return data_stream;
+	}
+
+	/* Decompress the data as it's read. The bytes already buffered in @data_stream are read through it, so it stays as the base stream. */
+	decompressor = trace_compression_new_converter (compression, FALSE, error);
+
+	if (decompressor == NULL) {
+		g_object_unref (data_stream);
+		return NULL;
+	}
+
+	decompressed_stream = g_converter_input_stream_new (G_INPUT_STREAM (data_stream), decompressor);
+	g_object_unref (decompressor);
+	g_object_unref (data_stream);
+
+	data_stream = new_trace_data_input_stream (decompressed_stream);
+	g_object_unref (decompressed_stream);
+
+	return data_stream;
+}
+
+static gboolean
+load_message_half (GDataInputStream *input_stream, GString *current_message, GCancellable *cancellable, GError **error)
+{
+	gsize len;
+	gchar *line = NULL;  /* owned */
+	GError *child_error = NULL;
+
+	while (TRUE) {
+		line = g_data_input_stream_read_line (input_stream, &len, cancellable, &child_error);
+
+		if (line == NULL && child_error != NULL) {
+			/* Error. */
+			g_propagate_error (error, child_error);
+			return FALSE;
+		} else if (line == NULL) {
+			/* EOF. Try again to grab a response. */
+			return TRUE;
+		} else {
+			gboolean reached_eom;
+
+			reached_eom = (g_strcmp0 (line, "  ") == 0);
+
+			g_string_append_len (current_message, line, len);
+			g_string_append_c (current_message, '\n');
+
+			g_free (line);
+
+			if (reached_eom) {
+				/* Reached the end of the message. */
+				return TRUE;
+			}
+		}
+	}
+}
+
+static UhmMessage *
+load_file_iteration (GDataInputStream *input_stream, GUri *base_uri, GCancellable *cancellable, GError **error)
+{
+	UhmMessage *output_message = NULL;
+	GString *current_message = NULL;
+
+	current_message = g_string_new (NULL);
+
+	do {
+		/* Start loading from the stream. */
+		g_string_truncate (current_message, 0);
+
+		/* We should be at the start of a request; grab it. */
+		if (!load_message_half (input_stream, current_message, cancellable, error) ||
+		    !load_message_half (input_stream, current_message, cancellable, error)) {
+			goto done;
+		}
+
+		if (current_message->len > 0) {
+			output_message = trace_to_soup_message (current_message->str, current_message->len, NULL, base_uri);
+		} else {
+			/* Reached the end of the file. */
+			output_message = NULL;
+		}
+	} while (output_message != NULL && uhm_message_get_status (output_message) == SOUP_STATUS_NONE);
+
+done:
+	/* Tidy up. */
+	g_string_free (current_message, TRUE);
+
+	/* Postcondition: (output_message != NULL) => (*error == NULL). */
+	g_assert (output_message == NULL || (error == NULL || *error == NULL));
+
+	return output_message;
+}
+
+/* Maps the whole of @trace_file into memory. Returns %NULL if that's not possible (for example, if @trace_file is not a local file), in which
+ * case the caller should fall back to load_file_stream(), which will report any I/O errors. */
+static GBytes *
+load_file_mapping (GFile *trace_file)
+{
+	g_autofree gchar *trace_path = NULL;
+	GMappedFile *mapped_file = NULL;  /* owned */
+	GBytes *trace_bytes;
+	g_autoptr(GError) child_error = NULL;
+
+	trace_path = g_file_get_path (trace_file);
+
+	if (trace_path == NULL) {
+		return NULL;
+	}
+
+	mapped_file = g_mapped_file_new (trace_path, FALSE, &child_error);
+
+	if (mapped_file == NULL) {
+		g_debug ("Error mapping trace file ‘%s’: %s", trace_path, child_error->message);
+		return NULL;
+	}
+
+	trace_bytes = g_mapped_file_get_bytes (mapped_file);
+	g_mapped_file_unref (mapped_file);
+
+	return trace_bytes;
+}
+
+/* Returns the offset of the end of the request or response starting at @offset in @data (i.e. just after its “  ” terminator line), or
+ * @length if the end of @data is reached first. This is the equivalent of load_message_half() for memory mapped traces. */
+static gsize
+find_message_half_end (const gchar *data, gsize length, gsize offset)
+{
+	while (offset < length) {
+		const gchar *line = data + offset;
+		const gchar *line_end;
+		gsize line_length;
+
+		line_end = memchr (line, '\n', length - offset);
+		line_length = (line_end != NULL) ? (gsize) (line_end - line) : length - offset;
+		offset += line_length + ((line_end != NULL) ? 1 : 0);
+
+		if (line_length == 2 && line[0] == ' ' && line[1] == ' ') {
+			/* Reached the end of the message. */
+			break;
+		}
+	}
+
+	return offset;
+}
+
+/* Parses the next message from the memory mapped @trace_bytes, starting at @offset, and updates @offset to point after it. Message bodies
+ * reference @trace_bytes, rather than copying from it. */
+static UhmMessage *
+load_mapping_iteration (GBytes *trace_bytes, gsize *offset, GUri *base_uri)
+{
+	UhmMessage *output_message = NULL;
+	const gchar *data;
+	gsize length;
+
+	data = g_bytes_get_data (trace_bytes, &length);
+
+	do {
+		gsize message_start, message_end;
+
+		/* We should be at the start of a request; grab it and its response. */
+		message_start = *offset;
+		message_end = find_message_half_end (data, length, message_start);
+		message_end = find_message_half_end (data, length, message_end);
+		*offset = message_end;
+
+		if (message_end > message_start) {
+			output_message = trace_to_soup_message (data + message_start, message_end - message_start, trace_bytes, base_uri);
+		} else {
+			/* Reached the end of the file. */
+			output_message = NULL;
+		}
+	} while (output_message != NULL && uhm_message_get_status (output_message) == SOUP_STATUS_NONE);
+
+	return output_message;
+}
+
+/* Compiled traces are a binary equivalent of the text trace format, produced by uhm_server_compile_trace(). They're memory mapped and
+ * accessed in place, so loading one doesn't require any parsing, and any message in the trace can be found in constant time.
+ *
+ * All integers are little-endian. Strings and bodies are stored as a guint32 length followed by that many bytes and then a nul byte (which
+ * isn't included in the length), so they can be used in place.
+ *   header:  "UHMTRACE", guint32 version, guint32 reserved
+ *   records: one per message (see compiled_trace_append_message())
+ *   index:   guint64 record offset, for each message
+ *   trailer: guint64 index offset, guint32 number of messages, guint32 reserved
+ */
+#define COMPILED_TRACE_MAGIC "UHMTRACE"
+#define COMPILED_TRACE_MAGIC_LENGTH 8
+#define COMPILED_TRACE_VERSION 1
+#define COMPILED_TRACE_HEADER_LENGTH (COMPILED_TRACE_MAGIC_LENGTH + 4 + 4)
+#define COMPILED_TRACE_TRAILER_LENGTH (8 + 4 + 4)
+
+typedef struct {
+	const guint8 *data;
+	gsize length;
+	gsize offset;  /* the readers fail if this is past length */
+} CompiledTraceCursor;
+
+static gboolean
+compiled_trace_read_uint32 (CompiledTraceCursor *cursor, guint32 *value)
+{
+	guint32 le_value;
+
+	if (cursor->offset > cursor->length || cursor->length - cursor->offset < sizeof (le_value)) {
+		return FALSE;
+	}
+
+	memcpy (&le_value, cursor->data + cursor->offset, sizeof (le_value));
+	*value = GUINT32_FROM_LE (le_value);
+	cursor->offset += sizeof (le_value);
+
+	return TRUE;
+}
+
+static gboolean
+compiled_trace_read_uint64 (CompiledTraceCursor *cursor, guint64 *value)
+{
+	guint64 le_value;
+
+	if (cursor->offset > cursor->length || cursor->length - cursor->offset < sizeof (le_value)) {
+		return FALSE;
+	}
+
+	memcpy (&le_value, cursor->data + cursor->offset, sizeof (le_value));
+	*value = GUINT64_FROM_LE (le_value);
+	cursor->offset += sizeof (le_value);
+
+	return TRUE;
+}
+
+/* The returned @string points into the trace data. */
+static gboolean
+compiled_trace_read_string (CompiledTraceCursor *cursor, const gchar **string, gsize *string_length)
+{
+	guint32 length;
+
+	if (!compiled_trace_read_uint32 (cursor, &length) ||
+	    cursor->length - cursor->offset <= (gsize) length ||
+	    cursor->data[cursor->offset + length] != '\0') {
+		return FALSE;
+	}
+
+	*string = (const gchar *) cursor->data + cursor->offset;
+	if (string_length != NULL) {
+		*string_length = length;
+	}
+	cursor->offset += (gsize) length + 1;
+
+	return TRUE;
+}
+
+static gboolean
+compiled_trace_read_headers (CompiledTraceCursor *cursor, SoupMessageHeaders *message_headers)
+{
+	guint32 n_headers, i;
+
+	if (!compiled_trace_read_uint32 (cursor, &n_headers)) {
+		return FALSE;
+	}
+
+	for (i = 0; i < n_headers; i++) {
+		const gchar *header_name, *header_value;
+
+		if (!compiled_trace_read_string (cursor, &header_name, NULL) ||
+		    !compiled_trace_read_string (cursor, &header_value, NULL)) {
+			return FALSE;
+		}
+
+		soup_message_headers_append (message_headers, header_name, header_value);
+	}
+
+	return TRUE;
+}
+
+static gboolean
+compiled_trace_read_body (CompiledTraceCursor *cursor, GBytes *trace_bytes, SoupMessageBody *message_body)
+{
+	const gchar *body;
+	gsize body_length;
+
+	if (!compiled_trace_read_string (cursor, &body, &body_length)) {
+		return FALSE;
+	}
+
+	message_body_append_trace (message_body, trace_bytes, body, body_length);
+	soup_message_body_complete (message_body);
+
+	return TRUE;
+}
+
+static gboolean
+compiled_trace_has_magic (GBytes *trace_bytes)
+{
+	gsize length;
+	const gchar *data = g_bytes_get_data (trace_bytes, &length);
+
+	return (length >= COMPILED_TRACE_MAGIC_LENGTH && memcmp (data, COMPILED_TRACE_MAGIC, COMPILED_TRACE_MAGIC_LENGTH) == 0);
+}
+
+/* Validates the header and trailer of the compiled trace in @trace_bytes, and returns the number of messages in it and the offset of its
+ * index. This doesn't look at any of the messages. */
+static gboolean
+compiled_trace_open (GBytes *trace_bytes, guint *n_messages, gsize *index_offset, GError **error)
+{
+	CompiledTraceCursor cursor;
+	guint32 version, reserved, trailer_n_messages;
+	guint64 trailer_index_offset;
+	gsize index_end;
+
+	cursor.data = g_bytes_get_data (trace_bytes, &cursor.length);
+	cursor.offset = COMPILED_TRACE_MAGIC_LENGTH;
+
+	if (!compiled_trace_read_uint32 (&cursor, &version) || !compiled_trace_read_uint32 (&cursor, &reserved)) {
+		goto corrupt;
+	} else if (version != COMPILED_TRACE_VERSION) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Unsupported compiled trace version %u.", version);
+		return FALSE;
+	}
+
+	if (cursor.length < COMPILED_TRACE_HEADER_LENGTH + COMPILED_TRACE_TRAILER_LENGTH) {
+		goto corrupt;
+	}
+
+	index_end = cursor.length - COMPILED_TRACE_TRAILER_LENGTH;
+	cursor.offset = index_end;
+
+	/* The index must lie between the header and the trailer, and exactly fill the space before the trailer. Compare without adding, so
+	 * that huge values in a corrupt trailer can't overflow. */
+	if (!compiled_trace_read_uint64 (&cursor, &trailer_index_offset) || !compiled_trace_read_uint32 (&cursor, &trailer_n_messages) ||
+	    trailer_n_messages > (index_end - COMPILED_TRACE_HEADER_LENGTH) / 8 ||
+	    trailer_index_offset < COMPILED_TRACE_HEADER_LENGTH || trailer_index_offset > index_end ||
+	    index_end - trailer_index_offset != (gsize) trailer_n_messages * 8) {
+		goto corrupt;
+	}
+
+	*n_messages = trailer_n_messages;
+	*index_offset = trailer_index_offset;
+
+	return TRUE;
+
+corrupt:
+	g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Corrupt compiled trace.");
+	return FALSE;
+}
+
+/* Loads message @index from the compiled trace in @trace_bytes, which must have been validated with compiled_trace_open(), and sets
+ * @record_end to the offset of the end of its record. Message bodies reference @trace_bytes, rather than copying from it. */
+static UhmMessage *
+compiled_trace_load_message (GBytes *trace_bytes, gsize index_offset, guint index, GUri *base_uri, gsize *record_end)
+{
+	CompiledTraceCursor cursor;
+	UhmMessage *message = NULL;
+	const gchar *method, *uri_string, *reason_phrase;
+	guint32 http_version, status;
+	guint64 record_offset;
+	g_autoptr(GUri) uri = NULL;
+
+	cursor.data = g_bytes_get_data (trace_bytes, &cursor.length);
+
+	if (index_offset > cursor.length) {
+		goto error;
+	}
+
+	cursor.offset = index_offset + (gsize) index * 8;
+
+	/* Records lie between the header and the index. */
+	if (!compiled_trace_read_uint64 (&cursor, &record_offset) ||
+	    record_offset < COMPILED_TRACE_HEADER_LENGTH || record_offset >= index_offset) {
+		goto error;
+	}
+
+	cursor.offset = record_offset;
+
+	if (!compiled_trace_read_string (&cursor, &method, NULL) ||
+	    !compiled_trace_read_string (&cursor, &uri_string, NULL) ||
+	    !compiled_trace_read_uint32 (&cursor, &http_version)) {
+		goto error;
+	}
+
+	uri = g_uri_parse_relative (base_uri, uri_string, SOUP_HTTP_URI_FLAGS, NULL);
+
+	if (uri == NULL) {
+		goto error;
+	}
+
+	message = uhm_message_new_from_uri (method, uri);
+	uhm_message_set_http_version (message, http_version);
+
+	if (!compiled_trace_read_headers (&cursor, uhm_message_get_request_headers (message)) ||
+	    !compiled_trace_read_body (&cursor, trace_bytes, uhm_message_get_request_body (message)) ||
+	    !compiled_trace_read_uint32 (&cursor, &status) ||
+	    !compiled_trace_read_string (&cursor, &reason_phrase, NULL) ||
+	    !compiled_trace_read_headers (&cursor, uhm_message_get_response_headers (message)) ||
+	    !compiled_trace_read_body (&cursor, trace_bytes, uhm_message_get_response_body (message))) {
+		goto error;
+	}
+
+	uhm_message_set_status (message, status, reason_phrase);
+	*record_end = cursor.offset;
+
+	return message;
+
+error:
+	g_warning ("Corrupt message %u in compiled trace.", index);
+	g_clear_object (&message);
+
+	return NULL;
+}
+
+static void
+compiled_trace_append_uint32 (GByteArray *record, guint32 value)
+{
+	guint32 le_value = GUINT32_TO_LE (value);
+
+	g_byte_array_append (record, (const guint8 *) &le_value, sizeof (le_value));
+}
+
+static void
+compiled_trace_append_uint64 (GByteArray *record, guint64 value)
+{
+	guint64 le_value = GUINT64_TO_LE (value);
+
+	g_byte_array_append (record, (const guint8 *) &le_value, sizeof (le_value));
+}
+
+static void
+compiled_trace_append_string (GByteArray *record, const gchar *string, gsize length)
+{
+	compiled_trace_append_uint32 (record, length);
+	g_byte_array_append (record, (const guint8 *) string, length);
+	g_byte_array_append (record, (const guint8 *) "", 1);
+}
+
+static void
+compiled_trace_append_headers (GByteArray *record, SoupMessageHeaders *message_headers)
+{
+	SoupMessageHeadersIter iter;
+	const gchar *header_name, *header_value;
+	guint n_headers = 0, n_headers_offset;
+	guint32 le_n_headers;
+
+	/* Write a placeholder for the number of headers, and fill it in afterwards. */
+	n_headers_offset = record->len;
+	compiled_trace_append_uint32 (record, 0);
+
+	soup_message_headers_iter_init (&iter, message_headers);
+	while (soup_message_headers_iter_next (&iter, &header_name, &header_value)) {
+		compiled_trace_append_string (record, header_name, strlen (header_name));
+		compiled_trace_append_string (record, header_value, strlen (header_value));
+		n_headers++;
+	}
+
+	le_n_headers = GUINT32_TO_LE (n_headers);
+	memcpy (record->data + n_headers_offset, &le_n_headers, sizeof (le_n_headers));
+}
+
+static void
+compiled_trace_append_body (GByteArray *record, SoupMessageBody *message_body)
+{
+	g_autoptr(GBytes) body = NULL;
+	gsize body_length;
+	const gchar *body_data;
+
+	body = soup_message_body_flatten (message_body);
+	body_data = g_bytes_get_data (body, &body_length);
+	compiled_trace_append_string (record, (body_data != NULL) ? body_data : "", body_length);
+}
+
+static void
+compiled_trace_append_message (GByteArray *record, UhmMessage *message)
+{
+	GUri *uri;
+	g_autofree gchar *uri_string = NULL;
+
+	/* Store the URI relative to the server, as in the text trace format. */
+	uri = uhm_message_get_uri (message);
+	uri_string = g_uri_join (G_URI_FLAGS_ENCODED, NULL, NULL, NULL, -1,
+	                         g_uri_get_path (uri), g_uri_get_query (uri), g_uri_get_fragment (uri));
+
+	compiled_trace_append_string (record, uhm_message_get_method (message), strlen (uhm_message_get_method (message)));
+	compiled_trace_append_string (record, uri_string, strlen (uri_string));
+	compiled_trace_append_uint32 (record, uhm_message_get_http_version (message));
+	compiled_trace_append_headers (record, uhm_message_get_request_headers (message));
+	compiled_trace_append_body (record, uhm_message_get_request_body (message));
+
+	compiled_trace_append_uint32 (record, uhm_message_get_status (message));
+	compiled_trace_append_string (record, (uhm_message_get_reason_phrase (message) != NULL) ? uhm_message_get_reason_phrase (message) : "",
+	                              (uhm_message_get_reason_phrase (message) != NULL) ? strlen (uhm_message_get_reason_phrase (message)) : 0);
+	compiled_trace_append_headers (record, uhm_message_get_response_headers (message));
+	compiled_trace_append_body (record, uhm_message_get_response_body (message));
+}
+
+/* Parses the next message from the memory mapped trace file, which may be in the compiled or text format. */
+static UhmMessage *
+load_mapped_message (UhmServer *self, GUri *base_uri)
+{
+	UhmServerPrivate *priv = self->priv;
+
+	if (priv->trace_is_compiled == TRUE) {
+		if (priv->compiled_next_index >= priv->compiled_n_messages) {
+			return NULL;
+		}
+
+		return compiled_trace_load_message (priv->trace_bytes, priv->compiled_index_offset, priv->compiled_next_index++, base_uri,
+		                                    &priv->compiled_offset);
+	}
+
+	return load_mapping_iteration (priv->trace_bytes, &priv->trace_offset, base_uri);
+}
+
+/* Loads all the remaining messages from the memory mapped trace file. Returns an array of #UhmMessages, which may be empty. */
+static GPtrArray *
+load_mapped_all_messages (UhmServer *self, GUri *base_uri)
+{
+	GPtrArray/*<owned UhmMessage>*/ *messages = NULL;  /* owned */
+	UhmMessage *message;
+
+	messages = g_ptr_array_new_with_free_func (g_object_unref);
+
+	while ((message = load_mapped_message (self, base_uri)) != NULL) {
+		g_ptr_array_add (messages, message);
+	}
+
+	return messages;
+}
+
+/* Loads all the remaining messages from @input_stream. Returns an array of #UhmMessages, which may be empty, or %NULL on error. */
+static GPtrArray *
+load_file_all_iterations (GDataInputStream *input_stream, GUri *base_uri, GCancellable *cancellable, GError **error)
+{
+	GPtrArray/*<owned UhmMessage>*/ *messages = NULL;  /* owned */
+	UhmMessage *message;
+	GError *child_error = NULL;
+
+	messages = g_ptr_array_new_with_free_func (g_object_unref);
+
+	while ((message = load_file_iteration (input_stream, base_uri, cancellable, &child_error)) != NULL) {
+		g_ptr_array_add (messages, message);
+	}
+
+	if (child_error != NULL) {
+		g_propagate_error (error, child_error);
+		g_ptr_array_unref (messages);
+
+		return NULL;
+	}
+
+	return messages;
+}
+
+static void
+load_file_stream_thread_cb (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	GFile *trace_file;
+	GDataInputStream *input_stream;
+	GError *child_error = NULL;
+
+	trace_file = task_data;
+	g_assert (G_IS_FILE (trace_file));
+
+	input_stream = load_file_stream (trace_file, cancellable, &child_error);
+
+	if (child_error != NULL) {
+		g_task_return_error (task, child_error);
+	} else {
+		g_task_return_pointer (task, input_stream, g_object_unref);
+	}
+}
+
+static void
+load_file_iteration_thread_cb (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	LoadFileIterationData *data = task_data;
+	GDataInputStream *input_stream;
+	GUri *base_uri;
+	GError *child_error = NULL;
+
+	input_stream = data->input_stream;
+	g_assert (G_IS_DATA_INPUT_STREAM (input_stream));
+	base_uri = data->base_uri;
+
+	if (data->preload == TRUE) {
+		GPtrArray *output_messages;
+
+		output_messages = load_file_all_iterations (input_stream, base_uri, cancellable, &child_error);
+
+		if (child_error != NULL) {
+			g_task_return_error (task, child_error);
 		} else {
-			/* Reached the end of the file. */
-			output_message = NULL;
+			g_task_return_pointer (task, output_messages, (GDestroyNotify) g_ptr_array_unref);
+		}
+	} else {
+		UhmMessage *output_message;
+
+		output_message = load_file_iteration (input_stream, base_uri, cancellable, &child_error);
+
+		if (child_error != NULL) {
+			g_task_return_error (task, child_error);
+		} else {
+			g_task_return_pointer (task, output_message, g_object_unref);
+		}
+	}
+}
+
+/**
+ * uhm_server_unload_trace:
+ * @self: a #UhmServer
+ *
+ * Unloads the current trace file of network messages, as loaded by uhm_server_load_trace() or uhm_server_load_trace_async().
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_unload_trace (UhmServer *self)
+{
+	UhmServerPrivate *priv = self->priv;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+
+	g_mutex_lock (&priv->trace_lock);
+
+	g_clear_pointer (&priv->trace_reader, trace_reader_free);
+	g_clear_object (&priv->next_message);
+	g_clear_object (&priv->input_stream);
+	g_clear_pointer (&priv->trace_bytes, g_bytes_unref);
+	priv->trace_offset = 0;
+	priv->trace_is_compiled = FALSE;
+	priv->compiled_n_messages = 0;
+	priv->compiled_index_offset = 0;
+	priv->compiled_next_index = 0;
+	priv->compiled_offset = 0;
+	priv->trace_read_position = 0;
+	g_clear_pointer (&priv->preloaded_messages, g_ptr_array_unref);
+	priv->preloaded_index = 0;
+	g_clear_pointer (&priv->unordered_index, g_hash_table_unref);
+	unordered_messages_free (priv);
+	g_clear_object (&priv->trace_file);
+	g_clear_pointer (&priv->trace_file_uri, g_free);
+	g_clear_pointer (&priv->comparison_message, g_byte_array_unref);
+	priv->message_counter = 0;
+	priv->received_message_state = UNKNOWN;
+
+	g_mutex_unlock (&priv->trace_lock);
+}
+
+/**
+ * uhm_server_load_trace:
+ * @self: a #UhmServer
+ * @trace_file: trace file to load
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Synchronously loads the given @trace_file of network messages, ready to simulate a network conversation by matching
+ * requests against the file and returning the associated responses. Call uhm_server_run() to start the mock
+ * server afterwards.
+ *
+ * Local trace files are mapped into memory and parsed in place, so message bodies are not copied out of the file. Trace files in the
+ * compiled format produced by uhm_server_compile_trace() are detected automatically; loading them requires no parsing, and they must be
+ * local files. Gzip-compressed trace files are also detected automatically, and are decompressed as they are read rather than being
+ * mapped. Zstandard-compressed trace files are detected, but loading them fails with %G_IO_ERROR_NOT_SUPPORTED.
+ *
+ * Loading the trace file may be cancelled from another thread using @cancellable.
+ *
+ * If #UhmServer:enable-preload is %TRUE, the whole trace file is parsed by this function, and no further I/O is done on it while
+ * the mock server is handling requests. Otherwise, only the first message is loaded, and subsequent messages are loaded a few at a
+ * time ahead of being needed, by a thread dedicated to the trace.
+ *
+ * On error, @error will be set and the state of the #UhmServer will not change. A #GIOError will be set if there is
+ * a problem reading the trace file.
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_load_trace (UhmServer *self, GFile *trace_file, GCancellable *cancellable, GError **error)
+{
+	UhmServerPrivate *priv = self->priv;
+	g_autoptr(GUri) base_uri = NULL;
+	g_autoptr(GError) local_error = NULL;
+	g_autofree char *content = NULL;
+	g_autofree char *trace_path = NULL;
+	g_autofree char *trace_hosts = NULL;
+	g_auto(GStrv) split = NULL;
+	gsize len;
+	gboolean is_cached;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (G_IS_FILE (trace_file));
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+	g_return_if_fail (error == NULL || *error == NULL);
+	g_return_if_fail (priv->trace_file == NULL && priv->input_stream == NULL && priv->trace_bytes == NULL && priv->next_message == NULL);
+
+	base_uri = build_base_uri (self);
+
+	/* Trace File. Use the preloaded copy if there is one; otherwise map it if possible, or read it as a stream. */
+	priv->trace_file = g_object_ref (trace_file);
+	priv->trace_file_uri = g_file_get_uri (trace_file);
+	priv->trace_bytes = trace_cache_lookup (self, priv->trace_file_uri, &content);
+	is_cached = (priv->trace_bytes != NULL);
+
+	if (is_cached == FALSE) {
+		priv->trace_bytes = load_file_mapping (priv->trace_file);
+	}
+
+	priv->trace_offset = 0;
+	priv->compiled_offset = 0;
+	priv->trace_read_position = 0;
+
+	if (priv->trace_bytes != NULL &&
+	    trace_compression_from_magic (g_bytes_get_data (priv->trace_bytes, NULL), g_bytes_get_size (priv->trace_bytes)) != TRACE_COMPRESSION_NONE) {
+		/* Compressed traces can't be parsed in place, so are decompressed as they're read from a stream instead. */
+		g_clear_pointer (&priv->trace_bytes, g_bytes_unref);
+	}
+
+	if (priv->trace_bytes == NULL) {
+		priv->input_stream = load_file_stream (priv->trace_file, cancellable, error);
+	} else if (compiled_trace_has_magic (priv->trace_bytes)) {
+		priv->trace_is_compiled = compiled_trace_open (priv->trace_bytes, &priv->compiled_n_messages, &priv->compiled_index_offset, error);
+		priv->compiled_next_index = 0;
+
+		if (priv->trace_is_compiled == FALSE) {
+			g_clear_pointer (&priv->trace_bytes, g_bytes_unref);
+		}
+	}
+
+	if (priv->trace_bytes != NULL || priv->input_stream != NULL) {
+		GError *child_error = NULL;
+
+		if (priv->enable_preload == TRUE || priv->enable_unordered_matching == TRUE) {
+			if (priv->trace_bytes != NULL) {
+				priv->preloaded_messages = load_mapped_all_messages (self, base_uri);
+			} else {
+				priv->preloaded_messages = load_file_all_iterations (priv->input_stream, base_uri, cancellable, &child_error);
+			}
+
+			priv->preloaded_index = 0;
+
+			if (priv->preloaded_messages != NULL) {
+				bind_trace_messages (self, priv->preloaded_messages, priv->port);
+				start_preloaded_replay (self);
+			}
+
+			statistics_update_trace_bytes_read (self);
+		} else {
+			if (priv->trace_bytes != NULL) {
+				priv->next_message = load_mapped_message (self, base_uri);
+			} else {
+				priv->next_message = load_file_iteration (priv->input_stream, base_uri, cancellable, &child_error);
+			}
+
+			statistics_update_trace_bytes_read (self);
+
+			/* Load the rest of the trace in the background. */
+			if (priv->next_message != NULL) {
+				bind_trace_message (self, priv->next_message, priv->port);
+				priv->trace_reader = trace_reader_new (self, base_uri);
+			}
+		}
+
+		priv->message_counter = 0;
+		priv->comparison_message = g_byte_array_new ();
+		priv->received_message_state = UNKNOWN;
+
+		if (child_error != NULL) {
+			g_clear_object (&priv->input_stream);
+			g_clear_pointer (&priv->trace_bytes, g_bytes_unref);
+			priv->trace_is_compiled = FALSE;
+			g_clear_object (&priv->trace_file);
+			g_clear_pointer (&priv->trace_file_uri, g_free);
+			g_propagate_error (error, child_error);
+			return;
+		}
+	} else {
+		/* Error. */
+		g_clear_object (&priv->trace_file);
+		g_clear_pointer (&priv->trace_file_uri, g_free);
+		return;
+	}
+
+	/* Host file */
+	trace_path = g_file_get_path (trace_file);
+	trace_hosts = g_strconcat (trace_path, ".hosts", NULL);
+	priv->hosts_trace_file = g_file_new_for_path (trace_hosts);
+
+	if ((is_cached == TRUE && content != NULL) ||
+	    (is_cached == FALSE && g_file_load_contents (priv->hosts_trace_file, cancellable, &content, &len, NULL, &local_error))) {
+		split = g_strsplit (content, "\n", -1);
+		for (gsize i = 0; split != NULL && split[i] != NULL; i++) {
+			if (*(split[i]) != '\0' && uhm_server_get_address (self) != NULL) {
+				uhm_resolver_add_A (priv->resolver, split[i], uhm_server_get_address (self));
+			}
+		}
+	} else if (is_cached == TRUE || g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+		/* It's not fatal that this file cannot be loaded as these hosts can be added in code */
+		g_clear_error (&local_error);
+
+	} else {
+		/* Other I/O errors are fatal. */
+		g_propagate_error (error, g_steal_pointer (&local_error));
+		return;
+	}
+}
+
+typedef struct {
+	GAsyncReadyCallback callback;
+	gpointer user_data;
+	GUri *base_uri;
+} LoadTraceData;
+
+static void
+load_trace_async_cb (GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+	UhmServer *self = UHM_SERVER (source_object);
+	LoadTraceData *data = user_data;
+	LoadFileIterationData *iteration_data;
+	GTask *task;
+	GError *child_error = NULL;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (G_IS_ASYNC_RESULT (result));
+	g_return_if_fail (g_task_is_valid (result, self));
+
+	self->priv->input_stream = g_task_propagate_pointer (G_TASK (result), &child_error);
+
+	iteration_data = g_slice_new (LoadFileIterationData);
+	iteration_data->input_stream = g_object_ref (self->priv->input_stream);
+	iteration_data->base_uri = data->base_uri; /* transfer ownership */
+	data->base_uri = NULL;
+	iteration_data->preload = (self->priv->enable_preload == TRUE || self->priv->enable_unordered_matching == TRUE);
+
+	task = g_task_new (g_task_get_source_object (G_TASK (result)), g_task_get_cancellable (G_TASK (result)), data->callback, data->user_data);
+	g_task_set_task_data (task, iteration_data, (GDestroyNotify) load_file_iteration_data_free);
+
+	if (child_error != NULL) {
+		g_task_return_error (task, child_error);
+	} else {
+		g_task_run_in_thread (task, load_file_iteration_thread_cb);
+	}
+
+	g_object_unref (task);
+
+	g_slice_free (LoadTraceData, data);
+}
+
+/**
+ * uhm_server_load_trace_async:
+ * @self: a #UhmServer
+ * @trace_file: trace file to load
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: function to call once the async operation is complete
+ * @user_data: (allow-none): user data to pass to @callback, or %NULL
+ *
+ * Asynchronous version of uhm_server_load_trace(). In @callback, call uhm_server_load_trace_finish() to complete the operation.
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_load_trace_async (UhmServer *self, GFile *trace_file, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	GTask *task;
+	LoadTraceData *data;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (G_IS_FILE (trace_file));
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+	g_return_if_fail (self->priv->trace_file == NULL && self->priv->input_stream == NULL && self->priv->trace_bytes == NULL && self->priv->next_message == NULL);
+
+	self->priv->trace_file = g_object_ref (trace_file);
+	self->priv->trace_file_uri = g_file_get_uri (trace_file);
+
+	data = g_slice_new (LoadTraceData);
+	data->callback = callback;
+	data->user_data = user_data;
+	data->base_uri = build_base_uri (self);
+
+	task = g_task_new (self, cancellable, load_trace_async_cb, data);
+	g_task_set_task_data (task, g_object_ref (self->priv->trace_file), g_object_unref);
+	g_task_run_in_thread (task, load_file_stream_thread_cb);
+	g_object_unref (task);
+}
+
+/**
+ * uhm_server_load_trace_finish:
+ * @self: a #UhmServer
+ * @result: asynchronous operation result passed to the callback
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes an asynchronous operation started by uhm_server_load_trace_async().
+ *
+ * On error, @error will be set and the state of the #UhmServer will not change.
+ * See uhm_server_load_trace() for details on the error domains used.
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_load_trace_finish (UhmServer *self, GAsyncResult *result, GError **error)
+{
+	LoadFileIterationData *data;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (G_IS_ASYNC_RESULT (result));
+	g_return_if_fail (error == NULL || *error == NULL);
+	g_return_if_fail (g_task_is_valid (result, self));
+
+	data = g_task_get_task_data (G_TASK (result));
+
+	if (data->preload == TRUE) {
+		self->priv->preloaded_messages = g_task_propagate_pointer (G_TASK (result), error);
+		self->priv->preloaded_index = 0;
+
+		if (self->priv->preloaded_messages != NULL) {
+			bind_trace_messages (self, self->priv->preloaded_messages, self->priv->port);
+			start_preloaded_replay (self);
 		}
-	} while (output_message != NULL && uhm_message_get_status (output_message) == SOUP_STATUS_NONE);
+	} else {
+		self->priv->next_message = g_task_propagate_pointer (G_TASK (result), error);
 
-done:
-	/* Tidy up. */
-	g_string_free (current_message, TRUE);
+		if (self->priv->next_message != NULL) {
+			bind_trace_message (self, self->priv->next_message, self->priv->port);
+		}
+	}
 
-	/* Postcondition: (output_message != NULL) => (*error == NULL). */
-	g_assert (output_message == NULL || (error == NULL || *error == NULL));
+	self->priv->message_counter = 0;
+	self->priv->comparison_message = g_byte_array_new ();
+	self->priv->received_message_state = UNKNOWN;
 
-	return output_message;
+	statistics_update_trace_bytes_read (self);
+
+	/* Load the rest of the trace in the background. */
+	if (data->preload == FALSE && self->priv->next_message != NULL) {
+		self->priv->trace_reader = trace_reader_new (self, data->base_uri);
+	}
+}
+
+/* Compiles the text trace read from @input_stream, writing the compiled trace to @output_stream. See uhm_server_compile_trace(). */
+static gboolean
+compile_trace_stream (GDataInputStream *input_stream, GOutputStream *output_stream, GCancellable *cancellable, GError **error)
+{
+	g_autoptr(GUri) base_uri = NULL;
+	g_autoptr(GByteArray) record = NULL;
+	g_autoptr(GArray) record_offsets = NULL;
+	UhmMessage *message;
+	guint64 offset;
+	guint i;
+	GError *child_error = NULL;
+
+	/* URIs are stored relative to the server, so the base URI is arbitrary. */
+	base_uri = g_uri_parse ("https://localhost", SOUP_HTTP_URI_FLAGS, NULL);
+	record = g_byte_array_new ();
+	record_offsets = g_array_new (FALSE, FALSE, sizeof (guint64));
+
+	g_byte_array_append (record, (const guint8 *) COMPILED_TRACE_MAGIC, COMPILED_TRACE_MAGIC_LENGTH);
+	compiled_trace_append_uint32 (record, COMPILED_TRACE_VERSION);
+	compiled_trace_append_uint32 (record, 0);
+	offset = 0;
+
+	/* Write out the header, then each message in turn. */
+	while (TRUE) {
+		if (!g_output_stream_write_all (output_stream, record->data, record->len, NULL, cancellable, error)) {
+			return FALSE;
+		}
+
+		offset += record->len;
+		g_byte_array_set_size (record, 0);
+
+		message = load_file_iteration (input_stream, base_uri, cancellable, &child_error);
+
+		if (message == NULL) {
+			break;
+		}
+
+		g_array_append_val (record_offsets, offset);
+		compiled_trace_append_message (record, message);
+		g_object_unref (message);
+	}
+
+	if (child_error != NULL) {
+		g_propagate_error (error, child_error);
+		return FALSE;
+	}
+
+	/* Index and trailer. */
+	for (i = 0; i < record_offsets->len; i++) {
+		compiled_trace_append_uint64 (record, g_array_index (record_offsets, guint64, i));
+	}
+
+	compiled_trace_append_uint64 (record, offset);
+	compiled_trace_append_uint32 (record, record_offsets->len);
+	compiled_trace_append_uint32 (record, 0);
+
+	if (!g_output_stream_write_all (output_stream, record->data, record->len, NULL, cancellable, error)) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * uhm_server_compile_trace:
+ * @trace_file: text trace file to compile
+ * @compiled_trace_file: file to write the compiled trace to
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Converts the text trace file @trace_file (as written in logging mode) into a compiled binary trace, and writes it to @compiled_trace_file,
+ * overwriting it if it already exists.
+ *
+ * Compiled traces contain the same messages as the original trace, but are stored as length-prefixed records with an index, so they can
+ * be loaded by uhm_server_load_trace() in constant time without being parsed. This is useful for large traces which are replayed often.
+ * uhm_server_load_trace() detects compiled traces automatically, provided @compiled_trace_file is a local file; they can't be loaded with
+ * uhm_server_load_trace_async(). Any hosts file accompanying @trace_file is not copied.
+ *
+ * On error, @error will be set. A #GIOError will be set if there is a problem reading @trace_file or writing @compiled_trace_file.
+ *
+ * Since: 0.12.0
+ */
+void
+uhm_server_compile_trace (GFile *trace_file, GFile *compiled_trace_file, GCancellable *cancellable, GError **error)
+{
+	g_autoptr(GDataInputStream) input_stream = NULL;
+	g_autoptr(GFileOutputStream) output_stream = NULL;
+
+	g_return_if_fail (G_IS_FILE (trace_file));
+	g_return_if_fail (G_IS_FILE (compiled_trace_file));
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+	g_return_if_fail (error == NULL || *error == NULL);
+
+	input_stream = load_file_stream (trace_file, cancellable, error);
+
+	if (input_stream == NULL) {
+		return;
+	}
+
+	output_stream = g_file_replace (compiled_trace_file, NULL, FALSE, G_FILE_CREATE_NONE, cancellable, error);
+
+	if (output_stream == NULL) {
+		return;
+	}
+
+	if (!compile_trace_stream (input_stream, G_OUTPUT_STREAM (output_stream), cancellable, error)) {
+		return;
+	}
+
+	g_output_stream_close (G_OUTPUT_STREAM (output_stream), cancellable, error);
 }
 
 static void
-load_file_stream_thread_cb (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+cached_trace_free (CachedTrace *cached_trace)
 {
-	GFile *trace_file;
-	GDataInputStream *input_stream;
+	g_bytes_unref (cached_trace->compiled_trace);
+	g_free (cached_trace->hosts);
+	g_slice_free (CachedTrace, cached_trace);
+}
+
+/* Looks up @trace_file_uri in the trace cache, returning a new reference to its compiled trace and a copy of its hosts file contents.
+ * Returns %NULL if the trace hasn't been preloaded. */
+static GBytes *
+trace_cache_lookup (UhmServer *self, const gchar *trace_file_uri, gchar **hosts)
+{
+	UhmServerPrivate *priv = self->priv;
+	CachedTrace *cached_trace;
+	GBytes *compiled_trace = NULL;
+
+	g_mutex_lock (&priv->trace_cache_lock);
+
+	cached_trace = g_hash_table_lookup (priv->trace_cache, trace_file_uri);
+
+	if (cached_trace != NULL) {
+		compiled_trace = g_bytes_ref (cached_trace->compiled_trace);
+		*hosts = g_strdup (cached_trace->hosts);
+	}
+
+	g_mutex_unlock (&priv->trace_cache_lock);
+
+	return compiled_trace;
+}
+
+static void
+trace_cache_remove (UhmServer *self, GFile *trace_file)
+{
+	UhmServerPrivate *priv = self->priv;
+	g_autofree gchar *trace_file_uri = g_file_get_uri (trace_file);
+
+	g_mutex_lock (&priv->trace_cache_lock);
+	g_hash_table_remove (priv->trace_cache, trace_file_uri);
+	g_mutex_unlock (&priv->trace_cache_lock);
+}
+
+typedef struct {
+	UhmServer *server;  /* unowned */
+	GCancellable *cancellable;  /* unowned */
+	GMutex lock;
+	GError *error;  /* owned; the first error from any trace; protected by lock */
+} PreloadTracesData;
+
+/* Reads, parses and compiles a trace file and its hosts file, and adds them to the trace cache. Called in the thread pool created by
+ * preload_traces(); @data is an owned #GFile. */
+static void
+preload_trace_cb (gpointer data, gpointer user_data)
+{
+	g_autoptr(GFile) trace_file = data;
+	PreloadTracesData *preload_data = user_data;
+	UhmServerPrivate *priv = preload_data->server->priv;
+	g_autoptr(GDataInputStream) input_stream = NULL;
+	g_autoptr(GOutputStream) output_stream = NULL;
+	g_autofree gchar *trace_path = NULL;
+	g_autofree gchar *hosts = NULL;
+	CachedTrace *cached_trace;
 	GError *child_error = NULL;
+	gboolean failed;
 
-	trace_file = task_data;
-	g_assert (G_IS_FILE (trace_file));
+	/* Give up early if another trace has already failed. */
+	g_mutex_lock (&preload_data->lock);
+	failed = (preload_data->error != NULL);
+	g_mutex_unlock (&preload_data->lock);
 
-	input_stream = load_file_stream (trace_file, cancellable, &child_error);
+	if (failed == TRUE || g_cancellable_set_error_if_cancelled (preload_data->cancellable, &child_error)) {
+		goto done;
+	}
+
+	/* Compile the trace into memory. */
+	input_stream = load_file_stream (trace_file, preload_data->cancellable, &child_error);
+
+	if (input_stream == NULL) {
+		goto done;
+	}
+
+	output_stream = g_memory_output_stream_new_resizable ();
+
+	if (!compile_trace_stream (input_stream, output_stream, preload_data->cancellable, &child_error) ||
+	    !g_output_stream_close (output_stream, preload_data->cancellable, &child_error)) {
+		goto done;
+	}
+
+	/* Hosts file. As with uhm_server_load_trace(), it's not an error for this to be missing. */
+	trace_path = g_file_get_path (trace_file);
+
+	if (trace_path != NULL) {
+		g_autofree gchar *trace_hosts = g_strconcat (trace_path, ".hosts", NULL);
+		g_autoptr(GFile) hosts_file = g_file_new_for_path (trace_hosts);
+
+		if (!g_file_load_contents (hosts_file, preload_data->cancellable, &hosts, NULL, NULL, &child_error)) {
+			if (!g_error_matches (child_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+				goto done;
+			}
+
+			g_clear_error (&child_error);
+		}
+	}
+
+	cached_trace = g_slice_new (CachedTrace);
+	cached_trace->compiled_trace = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output_stream));
+	cached_trace->hosts = g_steal_pointer (&hosts);
 
+	g_mutex_lock (&priv->trace_cache_lock);
+	g_hash_table_replace (priv->trace_cache, g_file_get_uri (trace_file), cached_trace);
+	g_mutex_unlock (&priv->trace_cache_lock);
+
+done:
 	if (child_error != NULL) {
-		g_task_return_error (task, child_error);
+		g_mutex_lock (&preload_data->lock);
+
+		if (preload_data->error == NULL) {
+			g_autofree gchar *trace_file_uri = g_file_get_uri (trace_file);
+
+			g_propagate_prefixed_error (&preload_data->error, child_error, "Error preloading trace file ‘%s’: ", trace_file_uri);
+		} else {
+			g_error_free (child_error);
+		}
+
+		g_mutex_unlock (&preload_data->lock);
+	}
+}
+
+/* Lists the trace files in @trace_directory, ignoring hosts files and anything which isn't a regular file. */
+static GPtrArray *
+list_trace_directory (GFile *trace_directory, GCancellable *cancellable, GError **error)
+{
+	g_autoptr(GFileEnumerator) enumerator = NULL;
+	g_autoptr(GPtrArray) trace_files = NULL;
+
+	enumerator = g_file_enumerate_children (trace_directory, G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE,
+	                                        G_FILE_QUERY_INFO_NONE, cancellable, error);
+
+	if (enumerator == NULL) {
+		return NULL;
+	}
+
+	trace_files = g_ptr_array_new_with_free_func (g_object_unref);
+
+	while (TRUE) {
+		GFileInfo *info;
+		GFile *child;
+
+		if (!g_file_enumerator_iterate (enumerator, &info, &child, cancellable, error)) {
+			return NULL;
+		} else if (info == NULL) {
+			break;
+		}
+
+		if (g_file_info_get_file_type (info) == G_FILE_TYPE_REGULAR && !g_str_has_suffix (g_file_info_get_name (info), ".hosts")) {
+			g_ptr_array_add (trace_files, g_object_ref (child));
+		}
+	}
+
+	return g_steal_pointer (&trace_files);
+}
+
+/* Preloads the named traces (or all of those in the trace directory, if @trace_names is %NULL), using a thread per processor. This blocks
+ * until they're all loaded. */
+static void
+preload_traces (UhmServer *self, GFile *trace_directory, const gchar * const *trace_names, GCancellable *cancellable, GError **error)
+{
+	g_autoptr(GPtrArray) trace_files = NULL;
+	PreloadTracesData data = { self, cancellable, };
+	GThreadPool *pool;
+	guint i;
+
+	if (trace_names != NULL) {
+		trace_files = g_ptr_array_new_with_free_func (g_object_unref);
+
+		for (i = 0; trace_names[i] != NULL; i++) {
+			g_ptr_array_add (trace_files, g_file_get_child (trace_directory, trace_names[i]));
+		}
 	} else {
-		g_task_return_pointer (task, input_stream, g_object_unref);
+		trace_files = list_trace_directory (trace_directory, cancellable, error);
+
+		if (trace_files == NULL) {
+			return;
+		}
 	}
+
+	if (trace_files->len == 0) {
+		return;
+	}
+
+	g_mutex_init (&data.lock);
+
+	pool = g_thread_pool_new (preload_trace_cb, &data, MIN (trace_files->len, (guint) g_get_num_processors ()), FALSE, NULL);
+
+	for (i = 0; i < trace_files->len; i++) {
+		g_thread_pool_push (pool, g_object_ref (g_ptr_array_index (trace_files, i)), NULL);
+	}
+
+	/* Wait for all the traces to be loaded. */
+	g_thread_pool_free (pool, FALSE, TRUE);
+
+	g_mutex_clear (&data.lock);
+
+	if (data.error != NULL) {
+		g_propagate_error (error, data.error);
+	}
+}
+
+/**
+ * uhm_server_preload_traces:
+ * @self: a #UhmServer
+ * @trace_names: (array zero-terminated=1) (allow-none): %NULL-terminated array of names of trace files in #UhmServer:trace-directory to
+ * preload, or %NULL to preload all of them
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Reads and parses the given trace files (and their hosts files) from #UhmServer:trace-directory, and caches them in memory in the compiled
+ * format used by uhm_server_compile_trace(). The traces are loaded concurrently, using a thread per processor. If @trace_names is %NULL,
+ * all the files in #UhmServer:trace-directory are preloaded, apart from hosts files.
+ *
+ * Subsequent calls to uhm_server_load_trace() (and hence uhm_server_start_trace() and uhm_server_start_trace_full()) for a preloaded trace
+ * file use the cached trace, rather than reading and parsing the file again. This is useful for test suites which use many traces, as it
+ * moves the cost of parsing them all out of the individual tests. Traces loaded with uhm_server_load_trace_async() don't use the cache.
+ *
+ * The cache isn't updated if a trace file is changed after being preloaded, except that a trace is removed from the cache when it's
+ * overwritten by logging to it with uhm_server_start_trace_full(). Preloading a trace again replaces the cached copy.
+ *
+ * On error, @error will be set, and some of the traces may have been added to the cache. A #GIOError will be set if there is a problem
+ * reading any of the trace files.
+ *
+ * Since: 0.12.0
+ */
+void
+uhm_server_preload_traces (UhmServer *self, const gchar * const *trace_names, GCancellable *cancellable, GError **error)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (self->priv->trace_directory != NULL);
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+	g_return_if_fail (error == NULL || *error == NULL);
+
+	preload_traces (self, self->priv->trace_directory, trace_names, cancellable, error);
+}
+
+typedef struct {
+	GFile *trace_directory;  /* owned */
+	gchar **trace_names;  /* owned; may be %NULL */
+} PreloadTracesAsyncData;
+
+static void
+preload_traces_async_data_free (PreloadTracesAsyncData *data)
+{
+	g_object_unref (data->trace_directory);
+	g_strfreev (data->trace_names);
+	g_slice_free (PreloadTracesAsyncData, data);
 }
 
 static void
-load_file_iteration_thread_cb (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+preload_traces_thread_cb (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
 {
-	LoadFileIterationData *data = task_data;
-	GDataInputStream *input_stream;
-	UhmMessage *output_message;
-	GUri *base_uri;
+	PreloadTracesAsyncData *data = task_data;
 	GError *child_error = NULL;
 
-	input_stream = data->input_stream;
-	g_assert (G_IS_DATA_INPUT_STREAM (input_stream));
-	base_uri = data->base_uri;
-
-	output_message = load_file_iteration (input_stream, base_uri, cancellable, &child_error);
+	preload_traces (UHM_SERVER (source_object), data->trace_directory, (const gchar * const *) data->trace_names, cancellable,
+	                &child_error);
 
 	if (child_error != NULL) {
 		g_task_return_error (task, child_error);
 	} else {
-		g_task_return_pointer (task, output_message, g_object_unref);
+		g_task_return_boolean (task, TRUE);
 	}
 }
 
 /**
- * uhm_server_unload_trace:
+ * uhm_server_preload_traces_async:
  * @self: a #UhmServer
+ * @trace_names: (array zero-terminated=1) (allow-none): %NULL-terminated array of names of trace files in #UhmServer:trace-directory to
+ * preload, or %NULL to preload all of them
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: function to call once the async operation is complete
+ * @user_data: (allow-none): user data to pass to @callback, or %NULL
  *
- * Unloads the current trace file of network messages, as loaded by uhm_server_load_trace() or uhm_server_load_trace_async().
+ * Asynchronous version of uhm_server_preload_traces(). In @callback, call uhm_server_preload_traces_finish() to complete the operation.
  *
- * Since: 0.1.0
+ * Since: 0.12.0
  */
 void
-uhm_server_unload_trace (UhmServer *self)
+uhm_server_preload_traces_async (UhmServer *self, const gchar * const *trace_names, GCancellable *cancellable, GAsyncReadyCallback callback,
+                                 gpointer user_data)
 {
-	UhmServerPrivate *priv = self->priv;
+	GTask *task;
+	PreloadTracesAsyncData *data;
 
 	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (self->priv->trace_directory != NULL);
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
 
-	g_clear_object (&priv->next_message);
-	g_clear_object (&priv->input_stream);
-	g_clear_object (&priv->trace_file);
-	g_clear_pointer (&priv->comparison_message, g_byte_array_unref);
-	priv->message_counter = 0;
-	priv->received_message_state = UNKNOWN;
+	data = g_slice_new (PreloadTracesAsyncData);
+	data->trace_directory = g_object_ref (self->priv->trace_directory);
+	data->trace_names = g_strdupv ((gchar **) trace_names);
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_source_tag (task, uhm_server_preload_traces_async);
+	g_task_set_task_data (task, data, (GDestroyNotify) preload_traces_async_data_free);
+	g_task_run_in_thread (task, preload_traces_thread_cb);
+	g_object_unref (task);
 }
 
 /**
- * uhm_server_load_trace:
+ * uhm_server_preload_traces_finish:
  * @self: a #UhmServer
- * @trace_file: trace file to load
- * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @result: asynchronous operation result passed to the callback
  * @error: (allow-none): return location for a #GError, or %NULL
  *
- * Synchronously loads the given @trace_file of network messages, ready to simulate a network conversation by matching
- * requests against the file and returning the associated responses. Call uhm_server_run() to start the mock
- * server afterwards.
- *
- * Loading the trace file may be cancelled from another thread using @cancellable.
+ * Finishes an asynchronous operation started by uhm_server_preload_traces_async().
  *
- * On error, @error will be set and the state of the #UhmServer will not change. A #GIOError will be set if there is
- * a problem reading the trace file.
+ * See uhm_server_preload_traces() for details on the error domains used.
  *
- * Since: 0.1.0
+ * Since: 0.12.0
  */
 void
-uhm_server_load_trace (UhmServer *self, GFile *trace_file, GCancellable *cancellable, GError **error)
+uhm_server_preload_traces_finish (UhmServer *self, GAsyncResult *result, GError **error)
 {
-	UhmServerPrivate *priv = self->priv;
-	g_autoptr(GUri) base_uri = NULL;
-	g_autoptr(GError) local_error = NULL;
-	g_autofree char *content = NULL;
-	g_autofree char *trace_path = NULL;
-	g_autofree char *trace_hosts = NULL;
-	g_auto(GStrv) split = NULL;
-	gsize len;
-
 	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (G_IS_FILE (trace_file));
-	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+	g_return_if_fail (g_task_is_valid (result, self));
 	g_return_if_fail (error == NULL || *error == NULL);
-	g_return_if_fail (priv->trace_file == NULL && priv->input_stream == NULL && priv->next_message == NULL);
 
-	base_uri = build_base_uri (self);
+	g_task_propagate_boolean (G_TASK (result), error);
+}
 
-	/* Trace File */
-	priv->trace_file = g_object_ref (trace_file);
-	priv->input_stream = load_file_stream (priv->trace_file, cancellable, error);
+typedef struct {
+	UhmServer *owner;  /* unowned */
+	SoupServer *server;  /* owned */
+	GIOStream *stream;  /* owned */
+	GSocketAddress *local_address;  /* owned */
+	GSocketAddress *remote_address;  /* owned */
+} AcceptConnectionData;
+
+/* ALPN protocols offered if UhmServer:enable-http2 is set, in order of preference. */
+static const gchar * const http2_protocols[] = { "h2", "http/1.1", NULL };
+
+/* Wraps @client_socket up, setting up TLS if needed, ready to be accepted by @server. Returns %NULL on error. */
+static AcceptConnectionData *
+accept_connection_data_new (UhmServer *self, SoupServer *server, GSocket *client_socket)
+{
+	UhmServerPrivate *priv = self->priv;
+	g_autoptr(GSocketConnection) connection = NULL;
+	AcceptConnectionData *data;
+	GError *child_error = NULL;
 
-	if (priv->input_stream != NULL) {
-		GError *child_error = NULL;
+	data = g_slice_new0 (AcceptConnectionData);
+	connection = g_socket_connection_factory_create_connection (client_socket);
 
-		priv->next_message = load_file_iteration (priv->input_stream, base_uri, cancellable, &child_error);
-		priv->message_counter = 0;
-		priv->comparison_message = g_byte_array_new ();
-		priv->received_message_state = UNKNOWN;
+	if (priv->tls_certificate != NULL) {
+		data->stream = g_tls_server_connection_new (G_IO_STREAM (connection), priv->tls_certificate, &child_error);
 
-		if (child_error != NULL) {
-			g_clear_object (&priv->trace_file);
-			g_propagate_error (error, child_error);
-			return;
+		if (data->stream == NULL) {
+			g_debug ("Error setting up TLS for mock server connection: %s", child_error->message);
+			g_error_free (child_error);
+			g_slice_free (AcceptConnectionData, data);
+
+			return NULL;
+		}
+
+		/* libsoup picks the protocol negotiated here when it sets up the connection. */
+		if (priv->enable_http2 == TRUE) {
+			g_tls_connection_set_advertised_protocols (G_TLS_CONNECTION (data->stream), http2_protocols);
 		}
 	} else {
-		/* Error. */
-		g_clear_object (&priv->trace_file);
+		data->stream = G_IO_STREAM (g_object_ref (connection));
+	}
+
+	/* libsoup only understands IP addresses. */
+	if (g_socket_get_family (client_socket) != G_SOCKET_FAMILY_UNIX) {
+		data->local_address = g_socket_get_local_address (client_socket, NULL);
+		data->remote_address = g_socket_get_remote_address (client_socket, NULL);
+	}
+
+	data->owner = self;
+	data->server = g_object_ref (server);
+
+	return data;
+}
+
+static void
+accept_connection_data_free (AcceptConnectionData *data)
+{
+	g_clear_object (&data->server);
+	g_clear_object (&data->stream);
+	g_clear_object (&data->local_address);
+	g_clear_object (&data->remote_address);
+
+	g_slice_free (AcceptConnectionData, data);
+}
+
+/* Hands the connection in @data to its SoupServer, and frees @data. */
+static void
+accept_connection_finish (AcceptConnectionData *data)
+{
+	GError *child_error = NULL;
+
+	if (!soup_server_accept_iostream (data->server, data->stream, data->local_address, data->remote_address, &child_error)) {
+		g_debug ("Error accepting mock server connection: %s", child_error->message);
+		g_error_free (child_error);
+	}
+
+	accept_connection_data_free (data);
+}
+
+static void
+accept_connection_handshake_cb (GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+	AcceptConnectionData *data = user_data;
+	GError *child_error = NULL;
+
+	if (!g_tls_connection_handshake_finish (G_TLS_CONNECTION (source_object), result, &child_error)) {
+		g_debug ("Error during TLS handshake for mock server connection: %s", child_error->message);
+		g_error_free (child_error);
+		accept_connection_data_free (data);
+
 		return;
 	}
 
-	/* Host file */
-	trace_path = g_file_get_path (trace_file);
-	trace_hosts = g_strconcat (trace_path, ".hosts", NULL);
-	priv->hosts_trace_file = g_file_new_for_path (trace_hosts);
+	statistics_add_tls_handshake (data->owner);
+	accept_connection_finish (data);
+}
 
-	if (g_file_load_contents (priv->hosts_trace_file, cancellable, &content, &len, NULL, &local_error)) {
-		split = g_strsplit (content, "\n", -1);
-		for (gsize i = 0; split != NULL && split[i] != NULL; i++) {
-			if (*(split[i]) != '\0') {
-				uhm_resolver_add_A (priv->resolver, split[i], uhm_server_get_address (self));
-			}
+/* Accepts the connection in @data, doing its TLS handshake first if needed, and frees @data. Must only be called in the thread of the worker
+ * which is to handle the connection. */
+static void
+accept_connection (AcceptConnectionData *data)
+{
+	/* Do the handshake here rather than leaving it to libsoup, so that completed handshakes can be counted. Handshaking again is a no-op
+	 * since GLib 2.64, so libsoup doesn't repeat it. */
+	if (G_IS_TLS_CONNECTION (data->stream)) {
+		g_tls_connection_handshake_async (G_TLS_CONNECTION (data->stream), G_PRIORITY_DEFAULT, NULL, accept_connection_handshake_cb, data);
+	} else {
+		accept_connection_finish (data);
+	}
+}
+
+/* Called in the thread of the worker which is to handle the connection, if the server thread accepted it. */
+static gboolean
+accept_connection_cb (gpointer user_data)
+{
+	AcceptConnectionData *data = user_data;
+
+	/* The handshake may outlive this callback, so move the connection out of @data, which is freed along with the invoking source. */
+	accept_connection (g_slice_dup (AcceptConnectionData, data));
+	memset (data, 0, sizeof (*data));
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Accepts all the pending connections on the listening @socket and hands them straight to @server. Must only be called in the thread
+ * which runs @server. */
+static void
+accept_connections (UhmServer *self, SoupServer *server, GSocket *socket)
+{
+	GSocket *client_socket;
+
+	/* The listening socket is non-blocking, so accept all the pending connections. */
+	while ((client_socket = g_socket_accept (socket, NULL, NULL)) != NULL) {
+		AcceptConnectionData *data;
+
+		statistics_add_connection (self);
+
+		data = accept_connection_data_new (self, server, client_socket);
+
+		if (data != NULL) {
+			accept_connection (data);
 		}
-	} else if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
-		/* It's not fatal that this file cannot be loaded as these hosts can be added in code */
-		g_clear_error (&local_error);
 
-	} else {
-		/* Other I/O errors are fatal. */
-		g_propagate_error (error, g_steal_pointer (&local_error));
-		return;
+		g_object_unref (client_socket);
 	}
 }
 
 typedef struct {
-	GAsyncReadyCallback callback;
-	gpointer user_data;
-	GUri *base_uri;
-} LoadTraceData;
+	UhmServer *owner;  /* unowned */
+	SoupServer *server;  /* owned */
+	GMainContext *context;  /* owned */
+	GMainLoop *main_loop;  /* owned */
+	GThread *thread;  /* owned */
+
+	/* Only set if the worker accepts its own connections; see UhmServer:enable-reuse-port. */
+	GSocket *listen_socket;  /* owned */
+	GSource *accept_source;  /* owned */
+} UhmServerWorker;
+
+/* Must only be called in the worker's thread. */
+static gboolean
+worker_accept_source_cb (GSocket *socket, GIOCondition condition, gpointer user_data)
+{
+	UhmServerWorker *worker = user_data;
+
+	accept_connections (worker->owner, worker->server, socket);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gpointer
+worker_thread_cb (gpointer user_data)
+{
+	UhmServerWorker *worker = user_data;
+
+	g_main_context_push_thread_default (worker->context);
+
+	g_main_loop_run (worker->main_loop);
+
+	/* Close any remaining client connections while the context is still the thread default. */
+	soup_server_disconnect (worker->server);
+
+	g_main_context_pop_thread_default (worker->context);
+
+	return NULL;
+}
+
+/* If @listen_socket is non-%NULL, the worker accepts connections on it itself; otherwise they're handed to it by the server thread. */
+static UhmServerWorker *
+worker_new (UhmServer *self, guint index, GSocket *listen_socket)
+{
+	UhmServerWorker *worker;
+	g_autofree gchar *thread_name = NULL;
+
+	worker = g_slice_new0 (UhmServerWorker);
+	worker->owner = self;
+	worker->context = g_main_context_new ();
+	worker->main_loop = g_main_loop_new (worker->context, FALSE);
+
+	/* TLS is set up when each connection is accepted, so the worker's server doesn't need a certificate. */
+	worker->server = soup_server_new ("raw-paths", TRUE, NULL);
+	soup_server_add_handler (worker->server, "/", server_handler_cb, self, NULL);
+
+	if (listen_socket != NULL) {
+		worker->listen_socket = g_object_ref (listen_socket);
+		worker->accept_source = g_socket_create_source (worker->listen_socket, G_IO_IN, NULL);
+		g_source_set_callback (worker->accept_source, (GSourceFunc) worker_accept_source_cb, worker, NULL);
+		g_source_attach (worker->accept_source, worker->context);
+	}
+
+	thread_name = g_strdup_printf ("mock-server-worker-%u", index);
+	worker->thread = g_thread_new (thread_name, worker_thread_cb, worker);
 
+	return worker;
+}
+
+/* Must only be called in the worker's thread. */
+static gboolean
+worker_thread_quit_cb (gpointer user_data)
+{
+	UhmServerWorker *worker = user_data;
+
+	g_main_loop_quit (worker->main_loop);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Stops the worker's thread and frees it. */
 static void
-load_trace_async_cb (GObject *source_object, GAsyncResult *result, gpointer user_data)
+worker_free (UhmServerWorker *worker)
 {
-	UhmServer *self = UHM_SERVER (source_object);
-	LoadTraceData *data = user_data;
-	LoadFileIterationData *iteration_data;
-	GTask *task;
-	GError *child_error = NULL;
+	GSource *idle;
 
-	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (G_IS_ASYNC_RESULT (result));
-	g_return_if_fail (g_task_is_valid (result, self));
+	idle = g_idle_source_new ();
+	g_source_set_callback (idle, worker_thread_quit_cb, worker, NULL);
+	g_source_attach (idle, worker->context);
+	g_source_unref (idle);
 
-	self->priv->input_stream = g_task_propagate_pointer (G_TASK (result), &child_error);
+	g_thread_join (worker->thread);
 
-	iteration_data = g_slice_new (LoadFileIterationData);
-	iteration_data->input_stream = g_object_ref (self->priv->input_stream);
-	iteration_data->base_uri = data->base_uri; /* transfer ownership */
-	data->base_uri = NULL;
+	if (worker->accept_source != NULL) {
+		g_source_destroy (worker->accept_source);
+		g_source_unref (worker->accept_source);
+	}
 
-	task = g_task_new (g_task_get_source_object (G_TASK (result)), g_task_get_cancellable (G_TASK (result)), data->callback, data->user_data);
-	g_task_set_task_data (task, iteration_data, (GDestroyNotify) load_file_iteration_data_free);
+	if (worker->listen_socket != NULL) {
+		g_socket_close (worker->listen_socket, NULL);
+		g_object_unref (worker->listen_socket);
+	}
 
-	if (child_error != NULL) {
-		g_task_return_error (task, child_error);
+	g_object_unref (worker->server);
+	g_main_loop_unref (worker->main_loop);
+	g_main_context_unref (worker->context);
+
+	g_slice_free (UhmServerWorker, worker);
+}
+
+/* Hands @client_socket to the next worker in turn. Must only be called in the server thread. */
+static void
+dispatch_connection (UhmServer *self, GSocket *client_socket)
+{
+	UhmServerPrivate *priv = self->priv;
+	AcceptConnectionData *data;
+	SoupServer *server;
+	GMainContext *context;
+
+	statistics_add_connection (self);
+
+	/* Worker 0 is the server thread itself. */
+	if (priv->next_worker == 0) {
+		server = priv->server;
+		context = priv->server_context;
 	} else {
-		g_task_run_in_thread (task, load_file_iteration_thread_cb);
+		UhmServerWorker *worker = g_ptr_array_index (priv->workers, priv->next_worker - 1);
+
+		server = worker->server;
+		context = worker->context;
 	}
 
-	g_object_unref (task);
+	priv->next_worker = (priv->next_worker + 1) % priv->n_workers;
 
-	g_slice_free (LoadTraceData, data);
+	data = accept_connection_data_new (self, server, client_socket);
+
+	if (data == NULL) {
+		return;
+	}
+
+	g_main_context_invoke_full (context, G_PRIORITY_DEFAULT, accept_connection_cb, data, (GDestroyNotify) accept_connection_data_free);
 }
 
-/**
- * uhm_server_load_trace_async:
- * @self: a #UhmServer
- * @trace_file: trace file to load
- * @cancellable: (allow-none): a #GCancellable, or %NULL
- * @callback: function to call once the async operation is complete
- * @user_data: (allow-none): user data to pass to @callback, or %NULL
- *
- * Asynchronous version of uhm_server_load_trace(). In @callback, call uhm_server_load_trace_finish() to complete the operation.
- *
- * Since: 0.1.0
- */
-void
-uhm_server_load_trace_async (UhmServer *self, GFile *trace_file, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+/* Must only be called in the server thread. */
+static gboolean
+accept_source_cb (GSocket *socket, GIOCondition condition, gpointer user_data)
 {
-	GTask *task;
-	LoadTraceData *data;
+	UhmServer *self = user_data;
+	GSocket *client_socket;
+
+	/* The listening socket is non-blocking, so accept all the pending connections. */
+	while ((client_socket = g_socket_accept (socket, NULL, NULL)) != NULL) {
+		dispatch_connection (self, client_socket);
+		g_object_unref (client_socket);
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+/* Must only be called in the server thread. Used instead of accept_source_cb() if each worker accepts its own connections. */
+static gboolean
+server_accept_source_cb (GSocket *socket, GIOCondition condition, gpointer user_data)
+{
+	UhmServer *self = user_data;
+
+	accept_connections (self, self->priv->server, socket);
+
+	return G_SOURCE_CONTINUE;
+}
+
+/* Creates a non-blocking listening socket on @port (or a random port if it's 0) on the loopback interface of @family. If @reuse_port is %TRUE,
+ * SO_REUSEPORT is set on the socket so that several sockets can listen on the same port. */
+static GSocket *
+listen_local_socket (GSocketFamily family, guint16 port, gboolean reuse_port, GError **error)
+{
+	g_autoptr(GSocket) socket = NULL;
+	g_autoptr(GInetAddress) loopback_address = NULL;
+	g_autoptr(GSocketAddress) address = NULL;
+
+	socket = g_socket_new (family, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, error);
+
+	if (socket == NULL) {
+		return NULL;
+	}
+
+	if (reuse_port == TRUE) {
+#ifdef SO_REUSEPORT
+		if (!g_socket_set_option (socket, SOL_SOCKET, SO_REUSEPORT, 1, error)) {
+			return NULL;
+		}
+#else
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "SO_REUSEPORT is not supported on this system.");
+		return NULL;
+#endif
+	}
+
+	loopback_address = g_inet_address_new_loopback (family);
+	address = g_inet_socket_address_new (loopback_address, port);
+
+	if (!g_socket_bind (socket, address, TRUE, error) || !g_socket_listen (socket, error)) {
+		return NULL;
+	}
+
+	g_socket_set_blocking (socket, FALSE);
+
+	return g_steal_pointer (&socket);
+}
 
-	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (G_IS_FILE (trace_file));
-	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
-	g_return_if_fail (self->priv->trace_file == NULL && self->priv->input_stream == NULL && self->priv->next_message == NULL);
+/* Removes the socket at @address if it was left behind by a server which wasn't stopped (for example, because its process crashed), which is
+ * the case if nothing is listening on it. Anything else at the path is left alone, so binding to it fails. */
+static void
+remove_stale_unix_socket (GSocketAddress *address)
+{
+	const gchar *path = g_unix_socket_address_get_path (G_UNIX_SOCKET_ADDRESS (address));
+	g_autoptr(GSocket) socket = NULL;
+	GStatBuf stat_buf;
 
-	self->priv->trace_file = g_object_ref (trace_file);
+	if (g_lstat (path, &stat_buf) != 0 || !S_ISSOCK (stat_buf.st_mode)) {
+		return;
+	}
 
-	data = g_slice_new (LoadTraceData);
-	data->callback = callback;
-	data->user_data = user_data;
-	data->base_uri = build_base_uri (self);
+	socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL);
 
-	task = g_task_new (self, cancellable, load_trace_async_cb, data);
-	g_task_set_task_data (task, g_object_ref (self->priv->trace_file), g_object_unref);
-	g_task_run_in_thread (task, load_file_stream_thread_cb);
-	g_object_unref (task);
+	if (socket != NULL && !g_socket_connect (socket, address, NULL, NULL)) {
+		g_debug ("Removing stale mock server socket ‘%s’.", path);
+		g_unlink (path);
+	}
 }
 
-/**
- * uhm_server_load_trace_finish:
- * @self: a #UhmServer
- * @result: asynchronous operation result passed to the callback
- * @error: (allow-none): return location for a #GError, or %NULL
- *
- * Finishes an asynchronous operation started by uhm_server_load_trace_async().
- *
- * On error, @error will be set and the state of the #UhmServer will not change.
- * See uhm_server_load_trace() for details on the error domains used.
- *
- * Since: 0.1.0
- */
-void
-uhm_server_load_trace_finish (UhmServer *self, GAsyncResult *result, GError **error)
+/* Creates a non-blocking listening socket at the Unix socket @path. See #UhmServer:unix-socket-path. */
+static GSocket *
+listen_unix_socket (const gchar *path, GError **error)
 {
-	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (G_IS_ASYNC_RESULT (result));
-	g_return_if_fail (error == NULL || *error == NULL);
-	g_return_if_fail (g_task_is_valid (result, self));
+	g_autoptr(GSocket) socket = NULL;
+	g_autoptr(GSocketAddress) address = NULL;
 
-	self->priv->next_message = g_task_propagate_pointer (G_TASK (result), error);
-	self->priv->message_counter = 0;
-	self->priv->comparison_message = g_byte_array_new ();
-	self->priv->received_message_state = UNKNOWN;
+	socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, error);
+
+	if (socket == NULL) {
+		return NULL;
+	}
+
+	if (path[0] == '@' && g_unix_socket_address_abstract_names_supported ()) {
+		address = g_unix_socket_address_new_with_type (path + 1, -1, G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+	} else {
+		address = g_unix_socket_address_new (path);
+		remove_stale_unix_socket (address);
+	}
+
+	if (!g_socket_bind (socket, address, FALSE, error) || !g_socket_listen (socket, error)) {
+		return NULL;
+	}
+
+	g_socket_set_blocking (socket, FALSE);
+
+	return g_steal_pointer (&socket);
 }
 
 /* Must only be called in the server thread. */
@@ -1390,7 +3943,8 @@ server_thread_cb (gpointer user_data)
  * once this function has returned. A #UhmResolver (exposed as #UhmServer:resolver) is set as the default #GResolver while the server is running.
  *
  * The server is started in a worker thread, so this function returns immediately and the server continues to run in the background. Use uhm_server_stop()
- * to shut it down.
+ * to shut it down. If #UhmServer:n-workers is greater than 1, that many threads are started to handle requests; if #UhmServer:enable-reuse-port
+ * is also %TRUE, each of them listens on its own socket bound to #UhmServer:port.
  *
  * This function always succeeds.
  *
@@ -1401,8 +3955,9 @@ uhm_server_run (UhmServer *self)
 {
 	UhmServerPrivate *priv = self->priv;
 	g_autoptr(GError) error = NULL;
-	GSList *sockets;  /* owned */
-	GSocket *socket;
+	gboolean reuse_port = FALSE;
+	guint16 port = 0;
+	guint i;
 
 	g_return_if_fail (UHM_IS_SERVER (self));
 	g_return_if_fail (priv->resolver == NULL);
@@ -1418,26 +3973,82 @@ uhm_server_run (UhmServer *self)
 
 	g_main_context_push_thread_default (priv->server_context);
 
-	/* Try listening on either IPv4 or IPv6. If that fails, try on IPv4 only
-	 * as listening on IPv6 while inside a Docker container (as happens in
-	 * CI) can fail if the container isn’t bridged properly. */
 	priv->server_main_loop = g_main_loop_new (priv->server_context, FALSE);
-	if (!soup_server_listen_local (priv->server, 0, (priv->tls_certificate != NULL) ? SOUP_SERVER_LISTEN_HTTPS : 0, NULL))
-		soup_server_listen_local (priv->server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY | ((priv->tls_certificate != NULL) ? SOUP_SERVER_LISTEN_HTTPS : 0), &error);
-	g_assert_no_error (error);  /* binding to localhost should never really fail */
+
+	/* Listen ourselves, and hand out the accepted connections to the workers (or have them accept their own connections; see
+	 * #UhmServer:enable-reuse-port). This lets the server set up TLS itself, so it can count handshakes and offer HTTP/2; and libsoup can
+	 * only listen on IP sockets itself, so this is also needed for Unix sockets. */
+	if (priv->unix_socket_path != NULL) {
+		priv->listen_socket = listen_unix_socket (priv->unix_socket_path, &error);
+		g_assert_no_error (error);  /* the path should have been chosen not to exist, other than as a stale socket */
+	} else {
+		g_autoptr(GSocketAddress) address = NULL;
+
+		/* Give each worker its own socket on the same port if possible, so they accept connections in parallel. */
+		if (priv->enable_reuse_port == TRUE && priv->n_workers > 1) {
+			priv->listen_socket = listen_local_socket (G_SOCKET_FAMILY_IPV4, 0, TRUE, &error);
+
+			if (priv->listen_socket != NULL) {
+				reuse_port = TRUE;
+			} else {
+				g_debug ("Error listening with SO_REUSEPORT; accepting all connections in the server thread instead: %s",
+				         error->message);
+				g_clear_error (&error);
+			}
+		}
+
+		if (priv->listen_socket == NULL) {
+			priv->listen_socket = listen_local_socket (G_SOCKET_FAMILY_IPV4, 0, FALSE, &error);
+			g_assert_no_error (error);  /* binding to localhost should never really fail */
+		}
+
+		address = g_socket_get_local_address (priv->listen_socket, &error);
+		g_assert_no_error (error);
+		port = g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (address));
+
+		/* Listen on the IPv6 loopback interface on the same port too, as soup_server_listen_local() does. Listening on IPv6 while
+		 * inside a Docker container (as happens in CI) can fail if the container isn't bridged properly, so fall back to IPv4 only. */
+		priv->listen_socket_ipv6 = listen_local_socket (G_SOCKET_FAMILY_IPV6, port, FALSE, &error);
+
+		if (priv->listen_socket_ipv6 == NULL) {
+			g_debug ("Error listening on IPv6; listening on IPv4 only: %s", error->message);
+			g_clear_error (&error);
+		}
+	}
+
+	priv->accept_source = g_socket_create_source (priv->listen_socket, G_IO_IN, NULL);
+	g_source_set_callback (priv->accept_source, (reuse_port == TRUE) ? (GSourceFunc) server_accept_source_cb : (GSourceFunc) accept_source_cb,
+	                       self, NULL);
+	g_source_attach (priv->accept_source, priv->server_context);
+
+	/* IPv6 connections are always accepted in the server thread, as the workers only listen on IPv4. */
+	if (priv->listen_socket_ipv6 != NULL) {
+		priv->accept_source_ipv6 = g_socket_create_source (priv->listen_socket_ipv6, G_IO_IN, NULL);
+		g_source_set_callback (priv->accept_source_ipv6,
+		                       (reuse_port == TRUE) ? (GSourceFunc) server_accept_source_cb : (GSourceFunc) accept_source_cb, self, NULL);
+		g_source_attach (priv->accept_source_ipv6, priv->server_context);
+	}
+
+	priv->workers = g_ptr_array_new_with_free_func ((GDestroyNotify) worker_free);
+	priv->next_worker = 0;
+
+	for (i = 1; i < priv->n_workers; i++) {
+		g_autoptr(GSocket) worker_socket = NULL;
+
+		if (reuse_port == TRUE) {
+			worker_socket = listen_local_socket (G_SOCKET_FAMILY_IPV4, port, TRUE, &error);
+			g_assert_no_error (error);  /* the first socket on the port had SO_REUSEPORT set too */
+		}
+
+		g_ptr_array_add (priv->workers, worker_new (self, i, worker_socket));
+	}
 
 	g_main_context_pop_thread_default (priv->server_context);
 
 	/* Grab the randomly selected address and port. */
-	sockets = soup_server_get_listeners (priv->server);
-	g_assert (sockets != NULL);
-
-	socket = sockets->data;
-	priv->address = g_socket_get_local_address (socket, &error);
+	priv->address = g_socket_get_local_address (priv->listen_socket, &error);
 	g_assert_no_error (error);
-	priv->port = g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (priv->address));
-
-	g_slist_free (sockets);
+	priv->port = G_IS_INET_SOCKET_ADDRESS (priv->address) ? g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (priv->address)) : 0;
 
 	/* Set up the resolver. It is expected that callers will grab the resolver (by calling uhm_server_get_resolver())
 	 * immediately after this function returns, and add some expected hostnames by calling uhm_resolver_add_A() one or
@@ -1491,6 +4102,34 @@ uhm_server_stop (UhmServer *self)
 	priv->server_thread = NULL;
 	uhm_resolver_reset (priv->resolver);
 
+	/* Stop the workers, if any. */
+	if (priv->accept_source != NULL) {
+		g_source_destroy (priv->accept_source);
+		g_clear_pointer (&priv->accept_source, g_source_unref);
+	}
+
+	if (priv->listen_socket != NULL) {
+		g_socket_close (priv->listen_socket, NULL);
+		g_clear_object (&priv->listen_socket);
+	}
+
+	if (priv->accept_source_ipv6 != NULL) {
+		g_source_destroy (priv->accept_source_ipv6);
+		g_clear_pointer (&priv->accept_source_ipv6, g_source_unref);
+	}
+
+	if (priv->listen_socket_ipv6 != NULL) {
+		g_socket_close (priv->listen_socket_ipv6, NULL);
+		g_clear_object (&priv->listen_socket_ipv6);
+	}
+
+	if (G_IS_UNIX_SOCKET_ADDRESS (priv->address) &&
+	    g_unix_socket_address_get_address_type (G_UNIX_SOCKET_ADDRESS (priv->address)) == G_UNIX_SOCKET_ADDRESS_PATH) {
+		g_unlink (g_unix_socket_address_get_path (G_UNIX_SOCKET_ADDRESS (priv->address)));
+	}
+
+	g_clear_pointer (&priv->workers, g_ptr_array_unref);
+
 	g_clear_pointer (&priv->server_main_loop, g_main_loop_unref);
 	g_clear_pointer (&priv->server_context, g_main_context_unref);
 	g_clear_object (&priv->server);
@@ -1595,10 +4234,12 @@ uhm_server_start_trace (UhmServer *self, const gchar *trace_name, GError **error
  * #UhmServer:enable-online.
  *
  * If #UhmServer:enable-logging is %TRUE, a log handler will be set up to redirect all client network activity into the given @trace_file.
- * If @trace_file already exists, it will be overwritten.
+ * If @trace_file already exists, it will be overwritten. If the name of @trace_file ends in <literal>.gz</literal>, the trace will be
+ * gzip-compressed as it is written; its accompanying hosts file is not compressed. Trace names ending in <literal>.zst</literal> are
+ * rejected with %G_IO_ERROR_NOT_SUPPORTED.
  *
  * If #UhmServer:enable-online is %FALSE, the given @trace_file is loaded using uhm_server_load_trace() and then a mock server is
- * started using uhm_server_run().
+ * started using uhm_server_run(). If #UhmServer:enable-persistent-listener is %TRUE and the mock server is already running, it's reused.
  *
  * On failure, @error will be set and the #UhmServer state will remain unchanged. A #GIOError will be set if logging is enabled
  * (#UhmServer:enable-logging) and there is a problem writing to the trace file; or if a trace needs to be loaded and there is a problem
@@ -1629,20 +4270,48 @@ uhm_server_start_trace_full (UhmServer *self, GFile *trace_file, GError **error)
 
 	/* Start writing out a trace file if logging is enabled. */
 	if (priv->enable_logging == TRUE) {
-		GFileOutputStream *output_stream;
+		g_autoptr(GFileOutputStream) output_stream = NULL;
+		g_autoptr(GConverter) compressor = NULL;
+		g_autoptr(GOutputStream) compressed_stream = NULL;
+		TraceCompression compression;
 		g_autofree char *trace_path = g_file_get_path (trace_file);
 		g_autofree char *trace_hosts = g_strconcat (trace_path, ".hosts", NULL);
+
+		/* Compress the trace file if its name has the extension of a supported compression format. */
+		compression = trace_compression_from_file_name (trace_file);
+
+		if (compression != TRACE_COMPRESSION_NONE) {
+			compressor = trace_compression_new_converter (compression, TRUE, &child_error);
+
+			if (compressor == NULL) {
+				g_propagate_prefixed_error (error, g_steal_pointer (&child_error),
+				             "Error replacing trace file ‘%s’: ", trace_path);
+				return;
+			}
+		}
+
 		priv->hosts_trace_file = g_file_new_for_path (trace_hosts);
 
+		/* Any preloaded copy of the trace is about to become stale. */
+		trace_cache_remove (self, trace_file);
+
 		output_stream = g_file_replace (trace_file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &child_error);
 
 		if (child_error != NULL) {
 			g_propagate_prefixed_error (error, g_steal_pointer (&child_error),
 			             "Error replacing trace file ‘%s’: ", trace_path);
 			return;
+		} else if (compressor != NULL) {
+			/* Change state. Buffer the trace file, so that logging each line doesn't block the code being traced on disk I/O or
+			 * compression. The buffer is flushed, and the compressed stream finished, by uhm_server_end_trace(). */
+			compressed_stream = g_converter_output_stream_new (G_OUTPUT_STREAM (output_stream), compressor);
+			priv->output_stream = g_buffered_output_stream_new_sized (compressed_stream, TRACE_OUTPUT_BUFFER_SIZE);
+			g_clear_object (&output_stream);
 		} else {
-			/* Change state. */
-			priv->output_stream = output_stream;
+			/* Change state. Buffer the trace file, so that logging each line doesn't block the code being traced on disk I/O. The buffer
+			 * is flushed by uhm_server_end_trace(). */
+			priv->output_stream = g_buffered_output_stream_new_sized (G_OUTPUT_STREAM (output_stream), TRACE_OUTPUT_BUFFER_SIZE);
+			g_clear_object (&output_stream);
 		}
 
 		/* Host trace file */
@@ -1654,13 +4323,19 @@ uhm_server_start_trace_full (UhmServer *self, GFile *trace_file, GError **error)
 			return;
 		} else {
 			/* Change state. */
-			priv->hosts_output_stream = output_stream;
+			priv->hosts_output_stream = g_buffered_output_stream_new (G_OUTPUT_STREAM (output_stream));
 		}
 	}
 
 	/* Start reading from a trace file if online testing is disabled or if we need to compare server responses to the trace file. */
 	if (priv->enable_online == FALSE) {
-		uhm_server_run (self);
+		gboolean was_running = (priv->enable_persistent_listener == TRUE && priv->server != NULL);
+
+		/* Keep using the running server if it's persistent. The previous trace was unloaded by uhm_server_end_trace(). */
+		if (was_running == FALSE) {
+			uhm_server_run (self);
+		}
+
 		uhm_server_load_trace (self, trace_file, NULL, &child_error);
 
 		if (child_error != NULL) {
@@ -1671,7 +4346,10 @@ uhm_server_start_trace_full (UhmServer *self, GFile *trace_file, GError **error)
 
 			g_error_free (child_error);
 
-			uhm_server_stop (self);
+			if (was_running == FALSE) {
+				uhm_server_stop (self);
+			}
+
 			g_clear_object (&priv->output_stream);
 
 			return;
@@ -1694,6 +4372,24 @@ uhm_server_start_trace_full (UhmServer *self, GFile *trace_file, GError **error)
 	}
 }
 
+/* Flushes and closes a trace output stream. Errors are only warned about, as uhm_server_end_trace() has no way to report them. */
+static void
+close_trace_output_stream (GOutputStream **output_stream)
+{
+	GError *child_error = NULL;
+
+	if (*output_stream == NULL) {
+		return;
+	}
+
+	if (!g_output_stream_close (*output_stream, NULL, &child_error)) {
+		g_warning ("Error writing trace file: %s", child_error->message);
+		g_error_free (child_error);
+	}
+
+	g_clear_object (output_stream);
+}
+
 /**
  * uhm_server_end_trace:
  * @self: a #UhmServer
@@ -1701,7 +4397,12 @@ uhm_server_start_trace_full (UhmServer *self, GFile *trace_file, GError **error)
  * Convenience function to finish logging to or reading from a trace file previously passed to uhm_server_start_trace() or
  * uhm_server_start_trace_full().
  *
- * If #UhmServer:enable-online is %FALSE, this will shut down the mock server (as if uhm_server_stop() had been called).
+ * If #UhmServer:enable-online is %FALSE, this will shut down the mock server (as if uhm_server_stop() had been called). If
+ * #UhmServer:enable-persistent-listener is %TRUE, the mock server is left running, and only the trace is unloaded and the
+ * #UhmServer:resolver reset.
+ *
+ * If #UhmServer:enable-logging is %TRUE, the trace file is buffered while it is being logged, and is only guaranteed to be completely written
+ * once this function returns.
  *
  * Since: 0.1.0
  */
@@ -1712,15 +4413,18 @@ uhm_server_end_trace (UhmServer *self)
 
 	g_return_if_fail (UHM_IS_SERVER (self));
 
-	if (priv->enable_online == FALSE) {
+	if (priv->enable_online == FALSE && priv->enable_persistent_listener == TRUE && priv->server != NULL) {
+		uhm_server_unload_trace (self);
+		apply_expected_domain_names (self);
+	} else if (priv->enable_online == FALSE) {
 		uhm_server_stop (self);
 	} else if (priv->enable_online == TRUE && priv->enable_logging == FALSE) {
 		uhm_server_unload_trace (self);
 	}
 
 	if (priv->enable_logging == TRUE) {
-		g_clear_object (&self->priv->output_stream);
-		g_clear_object (&self->priv->hosts_output_stream);
+		close_trace_output_stream (&self->priv->output_stream);
+		close_trace_output_stream (&self->priv->hosts_output_stream);
 	}
 }
 
@@ -1797,75 +4501,202 @@ uhm_server_set_enable_logging (UhmServer *self, gboolean enable_logging)
 }
 
 /**
- * uhm_server_received_message_chunk:
+ * uhm_server_get_enable_preload:
  * @self: a #UhmServer
- * @message_chunk: single line of a message which was received
- * @message_chunk_length: length of @message_chunk in bytes
- * @error: (allow-none): return location for a #GError, or %NULL
  *
- * Indicates to the mock server that a single new line of a message was received from the real server. The message line may be
- * appended to the current trace file if logging is enabled (#UhmServer:enable-logging is %TRUE), adding a newline character
- * at the end. If logging is disabled but online mode is enabled (#UhmServer:enable-online is %TRUE), the message line will
- * be compared to the next expected line in the existing trace file. Otherwise, this function is a no-op.
+ * Gets the value of the #UhmServer:enable-preload property.
  *
- * On failure, @error will be set and the #UhmServer state will remain unchanged apart from the parse state machine, which will remain
- * in the state reached after parsing @message_chunk. A %G_IO_ERROR will be returned if writing to the trace file failed. If in
- * comparison mode and the received message chunk corresponds to an unexpected message in the trace file, a %UHM_SERVER_ERROR will
- * be returned.
+ * Return value: %TRUE if trace files are parsed in their entirety when loaded; %FALSE otherwise
  *
- * <note><para>In common cases where message log data only needs to be passed to a #UhmServer and not (for example) logged to an
- * application-specific file or the command line as  well, it is simpler to use uhm_server_received_message_chunk_from_soup(), passing
- * it directly to soup_logger_set_printer(). See the documentation for uhm_server_received_message_chunk_from_soup() for details.</para></note>
+ * Since: 0.12.0
+ */
+gboolean
+uhm_server_get_enable_preload (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
+
+	return self->priv->enable_preload;
+}
+
+/**
+ * uhm_server_set_enable_preload:
+ * @self: a #UhmServer
+ * @enable_preload: %TRUE to parse trace files in their entirety when loading them; %FALSE otherwise
  *
- * Since: 0.1.0
+ * Sets the value of the #UhmServer:enable-preload property.
+ *
+ * Since: 0.12.0
  */
 void
-uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk, goffset message_chunk_length, GError **error)
+uhm_server_set_enable_preload (UhmServer *self, gboolean enable_preload)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+
+	self->priv->enable_preload = enable_preload;
+	g_object_notify (G_OBJECT (self), "enable-preload");
+}
+
+/**
+ * uhm_server_get_enable_unordered_matching:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:enable-unordered-matching property.
+ *
+ * Return value: %TRUE if requests may be matched against trace messages out of order; %FALSE otherwise
+ *
+ * Since: 0.12.0
+ */
+gboolean
+uhm_server_get_enable_unordered_matching (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
+
+	return self->priv->enable_unordered_matching;
+}
+
+/**
+ * uhm_server_set_enable_unordered_matching:
+ * @self: a #UhmServer
+ * @enable_unordered_matching: %TRUE to match requests against trace messages out of order; %FALSE otherwise
+ *
+ * Sets the value of the #UhmServer:enable-unordered-matching property.
+ *
+ * Since: 0.12.0
+ */
+void
+uhm_server_set_enable_unordered_matching (UhmServer *self, gboolean enable_unordered_matching)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+
+	self->priv->enable_unordered_matching = enable_unordered_matching;
+	g_object_notify (G_OBJECT (self), "enable-unordered-matching");
+}
+
+/**
+ * uhm_server_get_n_workers:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:n-workers property.
+ *
+ * Return value: number of threads requests are handled in
+ *
+ * Since: 0.12.0
+ */
+guint
+uhm_server_get_n_workers (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), 1);
+
+	return self->priv->n_workers;
+}
+
+/**
+ * uhm_server_set_n_workers:
+ * @self: a #UhmServer
+ * @n_workers: number of threads to handle requests in; must be at least 1
+ *
+ * Sets the value of the #UhmServer:n-workers property.
+ *
+ * Since: 0.12.0
+ */
+void
+uhm_server_set_n_workers (UhmServer *self, guint n_workers)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (n_workers >= 1);
+
+	self->priv->n_workers = n_workers;
+	g_object_notify (G_OBJECT (self), "n-workers");
+}
+
+/**
+ * uhm_server_get_enable_persistent_listener:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:enable-persistent-listener property.
+ *
+ * Return value: %TRUE if the mock server is kept running between traces; %FALSE otherwise
+ *
+ * Since: 0.12.0
+ */
+gboolean
+uhm_server_get_enable_persistent_listener (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
+
+	return self->priv->enable_persistent_listener;
+}
+
+/**
+ * uhm_server_set_enable_persistent_listener:
+ * @self: a #UhmServer
+ * @enable_persistent_listener: %TRUE to keep the mock server running between traces; %FALSE otherwise
+ *
+ * Sets the value of the #UhmServer:enable-persistent-listener property.
+ *
+ * Since: 0.12.0
+ */
+void
+uhm_server_set_enable_persistent_listener (UhmServer *self, gboolean enable_persistent_listener)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+
+	self->priv->enable_persistent_listener = enable_persistent_listener;
+	g_object_notify (G_OBJECT (self), "enable-persistent-listener");
+}
+
+/* Handles a line of a message, given as its @direction (‘>’, ‘<’ or ‘ ’) and the @data_length bytes of @data following the direction and
+ * space. @data may contain nul bytes. See uhm_server_received_message_chunk(). This doesn't allocate per line: the line is written out as
+ * a vector of its parts, and appended to the comparison message, whose buffer is reused. */
+static void
+received_message_line (UhmServer *self, gchar direction, const gchar *data, gsize data_length, GError **error)
 {
 	UhmServerPrivate *priv = self->priv;
 	GError *child_error = NULL;
 	g_autoptr(UhmMessage) online_message = NULL;
 	g_autoptr(GUri) base_uri = NULL;
-
-	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (message_chunk != NULL);
-	g_return_if_fail (error == NULL || *error == NULL);
+	gboolean is_request, is_response, is_terminator;
+	const gchar prefix[2] = { direction, ' ' };
 
 	/* Silently ignore the call if logging is disabled and we're offline, or if a trace file hasn't been specified. */
 	if ((priv->enable_logging == FALSE && priv->enable_online == FALSE) || (priv->enable_logging == TRUE && priv->output_stream == NULL)) {
 		return;
 	}
 
+	is_request = (direction == '>');
+	is_response = (direction == '<');
+	is_terminator = (direction == ' ' && data_length == 0);
+
 	/* Simple state machine to track where we are in the soup log format. */
 	switch (priv->received_message_state) {
 		case UNKNOWN:
-			if (strncmp (message_chunk, "> ", 2) == 0) {
+			if (is_request) {
 				priv->received_message_state = REQUEST_DATA;
 			}
 			break;
 		case REQUEST_DATA:
-			if (strcmp (message_chunk, "  ") == 0) {
+			if (is_terminator) {
 				priv->received_message_state = REQUEST_TERMINATOR;
-			} else if (strncmp (message_chunk, "> ", 2) != 0) {
+			} else if (!is_request) {
 				priv->received_message_state = UNKNOWN;
 			}
 			break;
 		case REQUEST_TERMINATOR:
-			if (strncmp (message_chunk, "< ", 2) == 0) {
+			if (is_response) {
 				priv->received_message_state = RESPONSE_DATA;
 			} else {
 				priv->received_message_state = UNKNOWN;
 			}
 			break;
 		case RESPONSE_DATA:
-			if (strcmp (message_chunk, "  ") == 0) {
+			if (is_terminator) {
 				priv->received_message_state = RESPONSE_TERMINATOR;
-			} else if (strncmp (message_chunk, "< ", 2) != 0) {
+			} else if (!is_response) {
 				priv->received_message_state = UNKNOWN;
 			}
 			break;
 		case RESPONSE_TERMINATOR:
-			if (strncmp (message_chunk, "> ", 2) == 0) {
+			if (is_request) {
 				priv->received_message_state = REQUEST_DATA;
 			} else {
 				priv->received_message_state = UNKNOWN;
@@ -1886,17 +4717,23 @@ uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk,
 	}
 
 	/* Append to the trace file. */
-	if (priv->enable_logging == TRUE &&
-	    (!g_output_stream_write_all (G_OUTPUT_STREAM (priv->output_stream), message_chunk, message_chunk_length, NULL, NULL, &child_error) ||
-	     !g_output_stream_write_all (G_OUTPUT_STREAM (priv->output_stream), "\n", 1, NULL, NULL, &child_error))) {
-		gchar *trace_file_path = g_file_get_path (priv->trace_file);
-		g_set_error (error, child_error->domain, child_error->code,
-		             "Error appending to log file ‘%s’: %s", trace_file_path, child_error->message);
-		g_free (trace_file_path);
+	if (priv->enable_logging == TRUE) {
+		GOutputVector line[] = {
+			{ prefix, sizeof (prefix) },
+			{ data, data_length },
+			{ "\n", 1 },
+		};
+
+		if (!g_output_stream_writev_all (G_OUTPUT_STREAM (priv->output_stream), line, G_N_ELEMENTS (line), NULL, NULL, &child_error)) {
+			gchar *trace_file_path = g_file_get_path (priv->trace_file);
+			g_set_error (error, child_error->domain, child_error->code,
+			             "Error appending to log file ‘%s’: %s", trace_file_path, child_error->message);
+			g_free (trace_file_path);
 
-		g_error_free (child_error);
+			g_error_free (child_error);
 
-		return;
+			return;
+		}
 	}
 
 	/* Update comparison message */
@@ -1904,13 +4741,15 @@ uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk,
 		/* Build up the message to compare. We explicitly don't escape nul bytes, because we want the trace
 		 * files to be (pretty much) ASCII. File uploads are handled by zero-extending the responses according
 		 * to the traced Content-Length. */
-		g_byte_array_append (priv->comparison_message, (const guint8 *) message_chunk, message_chunk_length);
+		g_byte_array_append (priv->comparison_message, (const guint8 *) prefix, sizeof (prefix));
+		g_byte_array_append (priv->comparison_message, (const guint8 *) data, data_length);
 		g_byte_array_append (priv->comparison_message, (const guint8 *) "\n", 1);
 
 		if (priv->received_message_state == RESPONSE_TERMINATOR) {
 			/* End of a message. */
 			base_uri = build_base_uri (self);
-			online_message = trace_to_soup_message ((const gchar *) priv->comparison_message->data, base_uri);
+			online_message = trace_to_soup_message ((const gchar *) priv->comparison_message->data, priv->comparison_message->len,
+			                                        NULL, base_uri);
 
 			g_byte_array_set_size (priv->comparison_message, 0);
 			priv->received_message_state = UNKNOWN;
@@ -1936,20 +4775,65 @@ uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk,
 		/* Received the last chunk of the response, so compare the message from the trace file and that from online. */
 		g_assert (priv->next_message != NULL);
 
-		/* Compare the message from the server with the message in the log file. */
-		if (compare_incoming_message (self, online_message, priv->next_message) != 0) {
-			gchar *next_uri, *actual_uri;
+		/* Compare the message from the server with the message in the log file. */
+		if (compare_incoming_message (self, online_message, priv->next_message) != 0) {
+			gchar *next_uri, *actual_uri;
+
+			next_uri = uri_get_path_query (uhm_message_get_uri (priv->next_message));
+			actual_uri = uri_get_path_query (uhm_message_get_uri (online_message));
+			g_set_error (error, UHM_SERVER_ERROR, UHM_SERVER_ERROR_MESSAGE_MISMATCH,
+			             "Expected URI ‘%s’, but got ‘%s’.", next_uri, actual_uri);
+			g_free (actual_uri);
+			g_free (next_uri);
+
+			g_object_unref (online_message);
+			return;
+		}
+	}
+}
+
+/**
+ * uhm_server_received_message_chunk:
+ * @self: a #UhmServer
+ * @message_chunk: single line of a message which was received
+ * @message_chunk_length: length of @message_chunk in bytes
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Indicates to the mock server that a single new line of a message was received from the real server. The message line may be
+ * appended to the current trace file if logging is enabled (#UhmServer:enable-logging is %TRUE), adding a newline character
+ * at the end. If logging is disabled but online mode is enabled (#UhmServer:enable-online is %TRUE), the message line will
+ * be compared to the next expected line in the existing trace file. Otherwise, this function is a no-op.
+ *
+ * On failure, @error will be set and the #UhmServer state will remain unchanged apart from the parse state machine, which will remain
+ * in the state reached after parsing @message_chunk. A %G_IO_ERROR will be returned if writing to the trace file failed. If in
+ * comparison mode and the received message chunk corresponds to an unexpected message in the trace file, a %UHM_SERVER_ERROR will
+ * be returned.
+ *
+ * <note><para>In common cases where message log data only needs to be passed to a #UhmServer and not (for example) logged to an
+ * application-specific file or the command line as  well, it is simpler to use uhm_server_received_message_chunk_from_soup(), passing
+ * it directly to soup_logger_set_printer(). See the documentation for uhm_server_received_message_chunk_from_soup() for details.</para></note>
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk, goffset message_chunk_length, GError **error)
+{
+	gsize length;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (message_chunk != NULL);
+	g_return_if_fail (message_chunk_length >= -1);
+	g_return_if_fail (error == NULL || *error == NULL);
 
-			next_uri = uri_get_path_query (uhm_message_get_uri (priv->next_message));
-			actual_uri = uri_get_path_query (uhm_message_get_uri (online_message));
-			g_set_error (error, UHM_SERVER_ERROR, UHM_SERVER_ERROR_MESSAGE_MISMATCH,
-			             "Expected URI ‘%s’, but got ‘%s’.", next_uri, actual_uri);
-			g_free (actual_uri);
-			g_free (next_uri);
+	length = (message_chunk_length > -1) ? (gsize) message_chunk_length : strlen (message_chunk);
 
-			g_object_unref (online_message);
-			return;
-		}
+	/* Split the direction off the chunk. Chunks which don't start with one are passed on with an invalid direction, so they reset the
+	 * state machine. */
+	if (length >= 2 && message_chunk[1] == ' ' &&
+	    (message_chunk[0] == '>' || message_chunk[0] == '<' || message_chunk[0] == ' ')) {
+		received_message_line (self, message_chunk[0], message_chunk + 2, length - 2, error);
+	} else {
+		received_message_line (self, '\0', message_chunk, length, error);
 	}
 }
 
@@ -1963,7 +4847,8 @@ uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk,
  *
  * Convenience version of uhm_server_received_message_chunk() which takes the
  * message @direction and @data separately, as provided by libsoup in a
- * #SoupLoggerPrinter callback.
+ * #SoupLoggerPrinter callback. @data may contain nul bytes if
+ * @data_length is given.
  *
  * <informalexample><programlisting>
  * UhmServer *mock_server;
@@ -1994,18 +4879,13 @@ uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk,
 void
 uhm_server_received_message_chunk_with_direction (UhmServer *self, char direction, const gchar *data, goffset data_length, GError **error)
 {
-	gchar *message_chunk;
-
 	g_return_if_fail (UHM_IS_SERVER (self));
 	g_return_if_fail (direction == '<' || direction == '>' || direction == ' ');
 	g_return_if_fail (data != NULL);
 	g_return_if_fail (data_length >= -1);
 	g_return_if_fail (error == NULL || *error == NULL);
 
-	/* This is inefficient and not nul-safe, but it’ll do for now. */
-	message_chunk = g_strdup_printf ("%c %s", direction, data);
-	uhm_server_received_message_chunk (self, message_chunk, (data_length > -1) ? data_length + 2 : -1, error);
-	g_free (message_chunk);
+	received_message_line (self, direction, data, (data_length > -1) ? (gsize) data_length : strlen (data), error);
 }
 
 /**
@@ -2053,6 +4933,7 @@ uhm_server_received_message_chunk_from_soup (SoupLogger *logger, SoupLoggerLogLe
  * Gets the value of the #UhmServer:address property.
  *
  * Return value: (allow-none) (transfer none): the physical address of the listening socket the server is currently bound to; or %NULL if the server is not running
+ * or is listening on a Unix socket
  *
  * Since: 0.1.0
  */
@@ -2063,7 +4944,7 @@ uhm_server_get_address (UhmServer *self)
 
 	g_return_val_if_fail (UHM_IS_SERVER (self), NULL);
 
-	if (self->priv->address == NULL) {
+	if (self->priv->address == NULL || !G_IS_INET_SOCKET_ADDRESS (self->priv->address)) {
 		return NULL;
 	}
 
@@ -2091,6 +4972,144 @@ uhm_server_get_port (UhmServer *self)
 	return self->priv->port;
 }
 
+/**
+ * uhm_server_get_connectable:
+ * @self: a #UhmServer
+ *
+ * Gets a #GSocketConnectable for connecting directly to the mock server, bypassing the #UhmServer:resolver. This is most useful when the
+ * server is listening on a Unix socket (see #UhmServer:unix-socket-path), when it may be passed to client code as the
+ * #SoupSession:remote-connectable of its #SoupSession:
+ * |[
+ * session = soup_session_new_with_options ("remote-connectable", uhm_server_get_connectable (mock_server), NULL);
+ * ]|
+ *
+ * Return value: (allow-none) (transfer full): a #GSocketConnectable for the address the mock server is listening on; or %NULL if the server
+ * is not running
+ *
+ * Since: 0.12.0
+ */
+GSocketConnectable *
+uhm_server_get_connectable (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), NULL);
+
+	if (self->priv->address == NULL) {
+		return NULL;
+	}
+
+	return G_SOCKET_CONNECTABLE (g_object_ref (self->priv->address));
+}
+
+/**
+ * uhm_server_get_unix_socket_path:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:unix-socket-path property.
+ *
+ * Return value: (allow-none): the path of the Unix socket to listen on; or %NULL to listen on TCP
+ *
+ * Since: 0.12.0
+ */
+const gchar *
+uhm_server_get_unix_socket_path (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), NULL);
+
+	return self->priv->unix_socket_path;
+}
+
+/**
+ * uhm_server_set_unix_socket_path:
+ * @self: a #UhmServer
+ * @unix_socket_path: (allow-none): the path of a Unix socket to listen on; or %NULL to listen on TCP
+ *
+ * Sets the value of the #UhmServer:unix-socket-path property.
+ *
+ * Since: 0.12.0
+ */
+void
+uhm_server_set_unix_socket_path (UhmServer *self, const gchar *unix_socket_path)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (unix_socket_path == NULL || *unix_socket_path != '\0');
+
+	g_free (self->priv->unix_socket_path);
+	self->priv->unix_socket_path = g_strdup (unix_socket_path);
+	g_object_notify (G_OBJECT (self), "unix-socket-path");
+}
+
+/**
+ * uhm_server_get_enable_reuse_port:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:enable-reuse-port property.
+ *
+ * Return value: %TRUE if each worker thread accepts connections on its own socket; %FALSE otherwise
+ *
+ * Since: 0.12.0
+ */
+gboolean
+uhm_server_get_enable_reuse_port (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
+
+	return self->priv->enable_reuse_port;
+}
+
+/**
+ * uhm_server_set_enable_reuse_port:
+ * @self: a #UhmServer
+ * @enable_reuse_port: %TRUE to accept connections on a socket per worker thread; %FALSE otherwise
+ *
+ * Sets the value of the #UhmServer:enable-reuse-port property.
+ *
+ * Since: 0.12.0
+ */
+void
+uhm_server_set_enable_reuse_port (UhmServer *self, gboolean enable_reuse_port)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+
+	self->priv->enable_reuse_port = enable_reuse_port;
+	g_object_notify (G_OBJECT (self), "enable-reuse-port");
+}
+
+/**
+ * uhm_server_get_enable_http2:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:enable-http2 property.
+ *
+ * Return value: %TRUE if HTTP/2 is offered to clients connecting using TLS; %FALSE otherwise
+ *
+ * Since: 0.12.0
+ */
+gboolean
+uhm_server_get_enable_http2 (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
+
+	return self->priv->enable_http2;
+}
+
+/**
+ * uhm_server_set_enable_http2:
+ * @self: a #UhmServer
+ * @enable_http2: %TRUE to offer HTTP/2 to clients connecting using TLS; %FALSE otherwise
+ *
+ * Sets the value of the #UhmServer:enable-http2 property.
+ *
+ * Since: 0.12.0
+ */
+void
+uhm_server_set_enable_http2 (UhmServer *self, gboolean enable_http2)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+
+	self->priv->enable_http2 = enable_http2;
+	g_object_notify (G_OBJECT (self), "enable-http2");
+}
+
 /**
  * uhm_server_get_resolver:
  * @self: a #UhmServer
@@ -2109,6 +5128,107 @@ uhm_server_get_resolver (UhmServer *self)
 	return self->priv->resolver;
 }
 
+static GVariant *
+statistics_histogram_to_variant (const StatisticsHistogram *histogram)
+{
+	g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
+
+	g_variant_dict_insert (&dict, "count", "t", histogram->count);
+	g_variant_dict_insert (&dict, "total-us", "t", histogram->total_time);
+	g_variant_dict_insert (&dict, "max-us", "t", histogram->max_time);
+	g_variant_dict_insert_value (&dict, "buckets",
+	                             g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64, histogram->buckets, STATISTICS_HISTOGRAM_N_BUCKETS,
+	                                                        sizeof (histogram->buckets[0])));
+
+	return g_variant_dict_end (&dict);
+}
+
+/**
+ * uhm_server_get_statistics:
+ * @self: a #UhmServer
+ *
+ * Gets statistics about the requests handled by the mock server since it was created, or since uhm_server_reset_statistics() was last
+ * called. These are useful for working out how much of the time taken by a slow test is spent in the mock server.
+ *
+ * The statistics are returned as a dictionary of type `a{sv}`, containing:
+ *  • `requests-handled` (`t`): number of requests handled by the default #UhmServer::handle-message handler.
+ *  • `mismatches` (`t`): number of those requests which didn't match the trace, and got an error response.
+ *  • `trace-bytes-read` (`t`): number of bytes of trace files which have been parsed into messages.
+ *  • `bytes-written` (`t`): number of bytes of response bodies which have been sent to clients.
+ *  • `connections` (`t`): number of client connections which have been accepted. Comparing this to `requests-handled` shows how often
+ *    clients reuse connections.
+ *  • `tls-handshakes` (`t`): number of TLS handshakes which have completed successfully on connections to an HTTPS server. Connections
+ *    whose handshake failed are counted in `connections` but not here. GIO doesn't report whether a handshake resumed an earlier TLS
+ *    session, so session resumption (which is left to the TLS backend) is not counted separately.
+ *  • `trace-fetch-time` (`a{sv}`): histogram of the time taken to fetch each expected message from the trace while handling requests.
+ *  • `compare-time` (`a{sv}`): histogram of the time taken by each comparison of a request against a message in the trace.
+ *
+ * Each histogram contains `count` (`t`), the number of durations recorded; `total-us` (`t`) and `max-us` (`t`), their sum and maximum in
+ * microseconds; and `buckets` (`at`), the number of durations in each bucket. Bucket 0 counts durations of less than 1µs, and bucket i
+ * counts durations of at least 2^(i−1)µs and less than 2^iµs, apart from the last bucket, which also counts all longer durations. Further
+ * keys may be added in future.
+ *
+ * Return value: (transfer full): a new #GVariant containing the statistics; unref with g_variant_unref()
+ *
+ * Since: 0.12.0
+ */
+GVariant *
+uhm_server_get_statistics (UhmServer *self)
+{
+	UhmServerPrivate *priv;
+	g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
+
+	g_return_val_if_fail (UHM_IS_SERVER (self), NULL);
+
+	priv = self->priv;
+
+	g_mutex_lock (&priv->statistics_lock);
+
+	g_variant_dict_insert (&dict, "requests-handled", "t", priv->requests_handled);
+	g_variant_dict_insert (&dict, "mismatches", "t", priv->mismatches);
+	g_variant_dict_insert (&dict, "trace-bytes-read", "t", priv->trace_bytes_read);
+	g_variant_dict_insert (&dict, "bytes-written", "t", priv->bytes_written);
+	g_variant_dict_insert (&dict, "connections", "t", priv->connections);
+	g_variant_dict_insert (&dict, "tls-handshakes", "t", priv->tls_handshakes);
+	g_variant_dict_insert_value (&dict, "trace-fetch-time", statistics_histogram_to_variant (&priv->trace_fetch_time));
+	g_variant_dict_insert_value (&dict, "compare-time", statistics_histogram_to_variant (&priv->compare_time));
+
+	g_mutex_unlock (&priv->statistics_lock);
+
+	return g_variant_ref_sink (g_variant_dict_end (&dict));
+}
+
+/**
+ * uhm_server_reset_statistics:
+ * @self: a #UhmServer
+ *
+ * Resets all the statistics returned by uhm_server_get_statistics() to zero.
+ *
+ * Since: 0.12.0
+ */
+void
+uhm_server_reset_statistics (UhmServer *self)
+{
+	UhmServerPrivate *priv;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+
+	priv = self->priv;
+
+	g_mutex_lock (&priv->statistics_lock);
+
+	priv->requests_handled = 0;
+	priv->mismatches = 0;
+	priv->trace_bytes_read = 0;
+	priv->bytes_written = 0;
+	priv->connections = 0;
+	priv->tls_handshakes = 0;
+	memset (&priv->trace_fetch_time, 0, sizeof (priv->trace_fetch_time));
+	memset (&priv->compare_time, 0, sizeof (priv->compare_time));
+
+	g_mutex_unlock (&priv->statistics_lock);
+}
+
 /**
  * uhm_server_get_tls_certificate:
  * @self: a #UhmServer
@@ -2155,6 +5275,30 @@ uhm_server_set_tls_certificate (UhmServer *self, GTlsCertificate *tls_certificat
 	g_object_notify (G_OBJECT (self), "tls-certificate");
 }
 
+/* Returns the parsed default TLS certificate of the given @certificate_type. Each certificate is only parsed once per process; the
+ * returned #GTlsCertificate is immutable, so may be shared between servers. */
+static GTlsCertificate *
+get_default_tls_certificate (UhmDefaultTlsCertificate certificate_type)
+{
+	static GTlsCertificate *default_tls_certificates[UHM_DEFAULT_TLS_CERTIFICATE_ECDSA + 1] = { NULL, };
+	static const gchar * const *default_tls_certificate_pems[] = {
+		[UHM_DEFAULT_TLS_CERTIFICATE_RSA] = &uhm_default_tls_certificate,
+		[UHM_DEFAULT_TLS_CERTIFICATE_ECDSA] = &uhm_default_tls_certificate_ecdsa,
+	};
+
+	if (g_once_init_enter (&default_tls_certificates[certificate_type])) {
+		GTlsCertificate *cert;
+		GError *child_error = NULL;
+
+		cert = g_tls_certificate_new_from_pem (*default_tls_certificate_pems[certificate_type], -1, &child_error);
+		g_assert_no_error (child_error);
+
+		g_once_init_leave (&default_tls_certificates[certificate_type], cert);
+	}
+
+	return default_tls_certificates[certificate_type];
+}
+
 /**
  * uhm_server_set_default_tls_certificate:
  * @self: a #UhmServer
@@ -2164,25 +5308,49 @@ uhm_server_set_tls_certificate (UhmServer *self, GTlsCertificate *tls_certificat
  * be used by clients which have no special certificate requirements; clients which have special requirements should
  * construct a custom #GTlsCertificate and pass it to uhm_server_set_tls_certificate().
  *
+ * This is equivalent to calling uhm_server_set_default_tls_certificate_full() with %UHM_DEFAULT_TLS_CERTIFICATE_RSA.
+ *
  * Return value: (transfer none): the default certificate set as #UhmServer:tls-certificate
  *
  * Since: 0.1.0
  */
 GTlsCertificate *
 uhm_server_set_default_tls_certificate (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), NULL);
+
+	return uhm_server_set_default_tls_certificate_full (self, UHM_DEFAULT_TLS_CERTIFICATE_RSA);
+}
+
+/**
+ * uhm_server_set_default_tls_certificate_full:
+ * @self: a #UhmServer
+ * @certificate_type: which of the default certificates to use
+ *
+ * Sets the value of the #UhmServer:tls-certificate property to one of the default TLS certificates built in to libuhttpmock, as with
+ * uhm_server_set_default_tls_certificate().
+ *
+ * %UHM_DEFAULT_TLS_CERTIFICATE_ECDSA makes TLS handshakes with the mock server considerably cheaper than the RSA certificate, which is
+ * useful for tests which open many short-lived HTTPS connections. It can only be used by clients which support ECDSA certificates.
+ *
+ * Each default certificate is only constructed once, and is shared between all the #UhmServers in the process which use it.
+ *
+ * Return value: (transfer none): the default certificate set as #UhmServer:tls-certificate
+ *
+ * Since: 0.12.0
+ */
+GTlsCertificate *
+uhm_server_set_default_tls_certificate_full (UhmServer *self, UhmDefaultTlsCertificate certificate_type)
 {
 	GTlsCertificate *cert;
-	GError *child_error = NULL;
 
 	g_return_val_if_fail (UHM_IS_SERVER (self), NULL);
+	g_return_val_if_fail (certificate_type == UHM_DEFAULT_TLS_CERTIFICATE_RSA || certificate_type == UHM_DEFAULT_TLS_CERTIFICATE_ECDSA, NULL);
 
-	/* Build the certificate. */
-	cert = g_tls_certificate_new_from_pem (uhm_default_tls_certificate, -1, &child_error);
-	g_assert_no_error (child_error);
+	cert = get_default_tls_certificate (certificate_type);
 
 	/* Set it as the property. */
 	uhm_server_set_tls_certificate (self, cert);
-	g_object_unref (cert);
 
 	return cert;
 }
@@ -2205,7 +5373,11 @@ apply_expected_domain_names (UhmServer *self)
 	}
 
 	ip_address = uhm_server_get_address (self);
-	g_assert (ip_address != NULL);
+
+	/* Domain names aren't resolved when listening on a Unix socket. */
+	if (ip_address == NULL) {
+		return;
+	}
 
 	for (i = 0; priv->expected_domain_names[i] != NULL; i++) {
 		uhm_resolver_add_A (priv->resolver, priv->expected_domain_names[i], ip_address);
@@ -2243,6 +5415,81 @@ uhm_server_set_expected_domain_names (UhmServer *self, const gchar * const *doma
 	apply_expected_domain_names (self);
 }
 
+static gint
+compare_strings_cb (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	return strcmp (*((const gchar * const *) a), *((const gchar * const *) b));
+}
+
+/* Returns the query parameters of @message, decoded as by soup_form_decode(), as a %NULL-terminated array of alternating names and values
+ * sorted by name. This is computed the first time it's needed for each message, and then cached on the message. Trace messages have it
+ * computed in advance while any ignore-parameter filters are installed (see bind_trace_message()), so it must only be computed for them
+ * with the trace lock held, or before they're shared with the threads handling requests. */
+static const gchar * const *
+message_get_sorted_query_parameters (UhmMessage *message)
+{
+	GQuark quark = g_quark_from_static_string ("uhm-sorted-query-parameters");
+	gchar **parameters;
+	const gchar *query;
+	GHashTable/*<string, string>*/ *params = NULL;  /* owned */
+	GPtrArray/*<unowned string>*/ *names = NULL;  /* owned */
+	GHashTableIter iter;
+	const gchar *name;
+	guint i;
+
+	parameters = g_object_get_qdata (G_OBJECT (message), quark);
+
+	if (parameters != NULL) {
+		return (const gchar * const *) parameters;
+	}
+
+	query = g_uri_get_query (uhm_message_get_uri (message));
+	params = (query != NULL) ? soup_form_decode (query) : g_hash_table_new (g_str_hash, g_str_equal);
+
+	names = g_ptr_array_sized_new (g_hash_table_size (params));
+	g_hash_table_iter_init (&iter, params);
+
+	while (g_hash_table_iter_next (&iter, (gpointer) &name, NULL)) {
+		g_ptr_array_add (names, (gpointer) name);
+	}
+
+	g_ptr_array_sort_with_data (names, compare_strings_cb, NULL);
+
+	parameters = g_new (gchar *, 2 * names->len + 1);
+
+	for (i = 0; i < names->len; i++) {
+		name = g_ptr_array_index (names, i);
+		parameters[2 * i] = g_strdup (name);
+		parameters[2 * i + 1] = g_strdup (g_hash_table_lookup (params, name));
+	}
+
+	parameters[2 * names->len] = NULL;
+
+	g_ptr_array_unref (names);
+	g_hash_table_unref (params);
+
+	g_object_set_qdata_full (G_OBJECT (message), quark, parameters, (GDestroyNotify) g_strfreev);
+
+	return (const gchar * const *) parameters;
+}
+
+/* Closure data for a compare-messages handler installed by uhm_server_filter_ignore_parameter_values(). */
+typedef struct {
+	UhmServer *server;  /* unowned; the server the handler is connected to */
+	gchar **parameter_names;  /* owned; names of the parameters whose values are ignored */
+} IgnoreParameterValuesFilter;
+
+/* Advances @index past any parameters in the sorted @parameters (see message_get_sorted_query_parameters()) which are in @ignored_names. */
+static gsize
+skip_ignored_parameters (const gchar * const *parameters, gsize index, const gchar * const *ignored_names)
+{
+	while (parameters[index] != NULL && g_strv_contains (ignored_names, parameters[index])) {
+		index += 2;
+	}
+
+	return index;
+}
+
 static gboolean
 compare_messages_ignore_parameter_values_cb (UhmServer *server,
                                              UhmMessage *expected_message,
@@ -2250,13 +5497,10 @@ compare_messages_ignore_parameter_values_cb (UhmServer *server,
                                              gpointer user_data)
 {
 	GUri *expected_uri, *actual_uri;
-	const gchar * const *ignore_query_param_values = user_data;
-	gboolean retval;
-	GHashTable/*<string, string>*/ *expected_params = NULL;  /* owned */
-	GHashTable/*<string, string>*/ *actual_params = NULL;  /* owned */
-	GHashTableIter iter;
-	const gchar *key, *expected_value;
-	guint i;
+	IgnoreParameterValuesFilter *filter = user_data;
+	const gchar * const *ignore_query_param_values = (const gchar * const *) filter->parameter_names;
+	const gchar * const *expected_params, * const *actual_params;
+	gsize i = 0, j = 0;
 
 	/* Compare method. */
 	if (g_strcmp0 (uhm_message_get_method (expected_message), uhm_message_get_method (actual_message)) != 0) {
@@ -2274,59 +5518,70 @@ compare_messages_ignore_parameter_values_cb (UhmServer *server,
 		return FALSE;
 	}
 
-	/* Compare query parameters, excluding the ignored ones. Note that we
-	 * expect the ignored parameters to exist, but their values may
-	 * differ. */
-	expected_params = soup_form_decode (g_uri_get_query (expected_uri));
-	actual_params = soup_form_decode (g_uri_get_query (actual_uri));
+	/* Compare query parameters, excluding the ignored ones, by walking the sorted parameters of both messages in step. The query of each
+	 * message is only decoded and sorted once, however many times it's compared; for the expected message, that's normally when it's
+	 * loaded. Note that we don't currently check that the ignored parameters are present. */
+	expected_params = message_get_sorted_query_parameters (expected_message);
+	actual_params = message_get_sorted_query_parameters (actual_message);
 
-	/* Check the presence of ignored parameters. */
-	for (i = 0; ignore_query_param_values[i] != NULL; i++) {
-		const gchar *name = ignore_query_param_values[i];
+	while (TRUE) {
+		i = skip_ignored_parameters (expected_params, i, ignore_query_param_values);
+		j = skip_ignored_parameters (actual_params, j, ignore_query_param_values);
 
-		if (g_hash_table_contains (expected_params, name) &&
-		    !g_hash_table_contains (expected_params, name)) {
-			retval = FALSE;
-			goto done;
+		if (expected_params[i] == NULL || actual_params[j] == NULL) {
+			return (expected_params[i] == NULL && actual_params[j] == NULL);
 		}
 
-		/* Remove them to simplify the comparison below. */
-		g_hash_table_remove (expected_params, name);
-		g_hash_table_remove (actual_params, name);
-	}
+		if (strcmp (expected_params[i], actual_params[j]) != 0 || strcmp (expected_params[i + 1], actual_params[j + 1]) != 0) {
+			return FALSE;
+		}
 
-	if (g_hash_table_size (actual_params) !=
-	    g_hash_table_size (expected_params)) {
-		retval = FALSE;
-		goto done;
+		i += 2;
+		j += 2;
 	}
+}
 
-	g_hash_table_iter_init (&iter, expected_params);
-
-	while (g_hash_table_iter_next (&iter, (gpointer) &key,
-	                               (gpointer) &expected_value)) {
-		if (g_strcmp0 (expected_value,
-		               g_hash_table_lookup (actual_params, key)) != 0) {
-			retval = FALSE;
-			goto done;
-		}
-	}
+static void
+parameter_names_closure_notify (gpointer  data,
+                                GClosure *closure)
+{
+	IgnoreParameterValuesFilter *filter = data;
 
-	retval = TRUE;
+	g_atomic_int_add (&filter->server->priv->n_ignore_parameter_filters, -1);
 
-done:
-	g_hash_table_unref (actual_params);
-	g_hash_table_unref (expected_params);
+	g_strfreev (filter->parameter_names);
+	g_slice_free (IgnoreParameterValuesFilter, filter);
+}
 
-	return retval;
+static void
+prepare_query_parameters_cb (gpointer data, gpointer user_data)
+{
+	message_get_sorted_query_parameters (data);
 }
 
+/* Computes the sorted query parameters of all the messages which are already loaded from the current trace, as bind_trace_message() does
+ * for those loaded from now on. */
 static void
-parameter_names_closure_notify (gpointer  data,
-                                GClosure *closure)
+prepare_trace_query_parameters (UhmServer *self)
 {
-	gchar **parameter_names = data;
-	g_strfreev (parameter_names);
+	UhmServerPrivate *priv = self->priv;
+	guint i;
+
+	g_mutex_lock (&priv->trace_lock);
+
+	if (priv->next_message != NULL) {
+		message_get_sorted_query_parameters (priv->next_message);
+	}
+
+	for (i = priv->preloaded_index; priv->preloaded_messages != NULL && i < priv->preloaded_messages->len; i++) {
+		message_get_sorted_query_parameters (g_ptr_array_index (priv->preloaded_messages, i));
+	}
+
+	if (priv->unordered_messages != NULL) {
+		g_queue_foreach (priv->unordered_messages, prepare_query_parameters_cb, NULL);
+	}
+
+	g_mutex_unlock (&priv->trace_lock);
 }
 
 /**
@@ -2355,14 +5610,23 @@ gulong
 uhm_server_filter_ignore_parameter_values (UhmServer *self,
                                            const gchar * const *parameter_names)
 {
+	IgnoreParameterValuesFilter *filter;
+
 	g_return_val_if_fail (UHM_IS_SERVER (self), 0);
 	g_return_val_if_fail (parameter_names != NULL, 0);
 
+	filter = g_slice_new (IgnoreParameterValuesFilter);
+	filter->server = self;
+	filter->parameter_names = g_strdupv ((gchar **) parameter_names);
+
+	g_atomic_int_inc (&self->priv->n_ignore_parameter_filters);
+	prepare_trace_query_parameters (self);
+
 	/* FIXME: What are the semantics of multiple installed compare-messages
 	 * callbacks? Should they be aggregate-true? */
 	return g_signal_connect_data (self, "compare-messages",
 	                              (GCallback) compare_messages_ignore_parameter_values_cb,
-	                              g_strdupv ((gchar **) parameter_names),
+	                              filter,
 	                              parameter_names_closure_notify,
 	                              0  /* connect flags */);
 }
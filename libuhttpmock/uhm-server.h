@@ -44,6 +44,20 @@ typedef enum {
 
 GQuark uhm_server_error_quark (void) G_GNUC_CONST;
 
+/**
+ * UhmDefaultTlsCertificate:
+ * @UHM_DEFAULT_TLS_CERTIFICATE_RSA: The default certificate, with a 2048-bit RSA key.
+ * @UHM_DEFAULT_TLS_CERTIFICATE_ECDSA: A certificate with an ECDSA key on the NIST P-256 curve, which is cheaper to handshake with.
+ *
+ * Default TLS certificates built in to libuhttpmock, for use with uhm_server_set_default_tls_certificate_full().
+ *
+ * Since: 0.12.0
+ **/
+typedef enum {
+	UHM_DEFAULT_TLS_CERTIFICATE_RSA = 0,
+	UHM_DEFAULT_TLS_CERTIFICATE_ECDSA,
+} UhmDefaultTlsCertificate;
+
 #define UHM_TYPE_SERVER			(uhm_server_get_type ())
 #define UHM_SERVER(o)			(G_TYPE_CHECK_INSTANCE_CAST ((o), UHM_TYPE_SERVER, UhmServer))
 #define UHM_SERVER_CLASS(k)		(G_TYPE_CHECK_CLASS_CAST((k), UHM_TYPE_SERVER, UhmServerClass))
@@ -97,6 +111,13 @@ void uhm_server_load_trace_async (UhmServer *self, GFile *trace_file, GCancellab
 void uhm_server_load_trace_finish (UhmServer *self, GAsyncResult *result, GError **error);
 void uhm_server_unload_trace (UhmServer *self);
 
+void uhm_server_compile_trace (GFile *trace_file, GFile *compiled_trace_file, GCancellable *cancellable, GError **error);
+
+void uhm_server_preload_traces (UhmServer *self, const gchar * const *trace_names, GCancellable *cancellable, GError **error);
+void uhm_server_preload_traces_async (UhmServer *self, const gchar * const *trace_names, GCancellable *cancellable,
+                                      GAsyncReadyCallback callback, gpointer user_data);
+void uhm_server_preload_traces_finish (UhmServer *self, GAsyncResult *result, GError **error);
+
 void uhm_server_run (UhmServer *self);
 void uhm_server_stop (UhmServer *self);
 
@@ -113,19 +134,45 @@ void uhm_server_set_enable_online (UhmServer *self, gboolean enable_online);
 gboolean uhm_server_get_enable_logging (UhmServer *self);
 void uhm_server_set_enable_logging (UhmServer *self, gboolean enable_logging);
 
+gboolean uhm_server_get_enable_preload (UhmServer *self);
+void uhm_server_set_enable_preload (UhmServer *self, gboolean enable_preload);
+
+gboolean uhm_server_get_enable_unordered_matching (UhmServer *self);
+void uhm_server_set_enable_unordered_matching (UhmServer *self, gboolean enable_unordered_matching);
+
+guint uhm_server_get_n_workers (UhmServer *self);
+void uhm_server_set_n_workers (UhmServer *self, guint n_workers);
+
+gboolean uhm_server_get_enable_persistent_listener (UhmServer *self);
+void uhm_server_set_enable_persistent_listener (UhmServer *self, gboolean enable_persistent_listener);
+
+const gchar *uhm_server_get_unix_socket_path (UhmServer *self);
+void uhm_server_set_unix_socket_path (UhmServer *self, const gchar *unix_socket_path);
+
+gboolean uhm_server_get_enable_reuse_port (UhmServer *self);
+void uhm_server_set_enable_reuse_port (UhmServer *self, gboolean enable_reuse_port);
+
+gboolean uhm_server_get_enable_http2 (UhmServer *self);
+void uhm_server_set_enable_http2 (UhmServer *self, gboolean enable_http2);
+
 void uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk, goffset message_chunk_length, GError **error);
 void uhm_server_received_message_chunk_with_direction (UhmServer *self, char direction, const gchar *data, goffset data_length, GError **error);
 void uhm_server_received_message_chunk_from_soup (SoupLogger *logger, SoupLoggerLogLevel level, char direction, const char *data, gpointer user_data);
 
 const gchar *uhm_server_get_address (UhmServer *self);
 guint uhm_server_get_port (UhmServer *self);
+GSocketConnectable *uhm_server_get_connectable (UhmServer *self) G_GNUC_WARN_UNUSED_RESULT;
 
 UhmResolver *uhm_server_get_resolver (UhmServer *self);
 
+GVariant *uhm_server_get_statistics (UhmServer *self) G_GNUC_WARN_UNUSED_RESULT;
+void uhm_server_reset_statistics (UhmServer *self);
+
 GTlsCertificate *uhm_server_get_tls_certificate (UhmServer *self);
 void uhm_server_set_tls_certificate (UhmServer *self, GTlsCertificate *tls_certificate);
 
-GTlsCertificate *uhm_server_set_default_tls_certificate (UhmServer *self) G_GNUC_MALLOC;
+GTlsCertificate *uhm_server_set_default_tls_certificate (UhmServer *self);
+GTlsCertificate *uhm_server_set_default_tls_certificate_full (UhmServer *self, UhmDefaultTlsCertificate certificate_type);
 
 void uhm_server_set_expected_domain_names (UhmServer *self, const gchar * const *domain_names);
 